@@ -0,0 +1,230 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+template <typename R>
+class ReplySlot;
+
+/**
+ * The sending half of a ReplySlot, carried inside a request message. Trivially copyable, so a
+ * request holding one still fits in a mailbox slot by value.
+ */
+template <typename R>
+class Reply final {
+  public:
+    Reply() = default;
+    explicit Reply(ReplySlot<R>* slot) : slot_(slot) {}
+
+    // Must be called exactly once, on whichever thread handles the request.
+    void Send(R value) const { slot_->Set(std::move(value)); }
+
+  private:
+    ReplySlot<R>* slot_ = nullptr;
+};
+
+/**
+ * Receives one reply without touching the heap: the slot lives on the asking thread's stack and
+ * the request carries a Reply pointing at it. Wait() blocks, so never ask an actor that runs on
+ * the asking thread's own looper.
+ */
+template <typename R>
+class ReplySlot final {
+  public:
+    ReplySlot() = default;
+    ~ReplySlot() = default;
+
+    ReplySlot(const ReplySlot&) = delete;
+    ReplySlot& operator=(const ReplySlot&) = delete;
+
+  public:
+    [[nodiscard]] Reply<R> Handle() { return Reply<R>(this); }
+
+    R Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return value_.has_value(); });
+        return std::move(*value_);
+    }
+
+  private:
+    friend class Reply<R>;
+
+    void Set(R value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        value_.emplace(std::move(value));
+        // Notified under the lock: the waiter may destroy the slot as soon as it sees the value.
+        cv_.notify_one();
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::optional<R> value_;
+};
+
+/**
+ * An actor: a `State` object that only ever runs on one looper at a time and is reached through a
+ * typed mailbox. Messages are `std::variant<Msg...>` values stored in place in a bounded ring, so
+ * sending does not allocate. The actor is scheduled on its looper through a single reused message,
+ * only while its mailbox is non-empty, and drains up to `kBatch` messages per turn before giving
+ * the looper to others.
+ *
+ * `State` handles each message type with an overload of `void Receive(Msg&)`. Any number of
+ * threads may send.
+ */
+template <typename State, typename... Msg>
+class Actor final {
+  public:
+    using Mailbox = std::variant<Msg...>;
+
+    static constexpr size_t kDefaultCapacity = 1024;
+    static constexpr size_t kBatch = 64;
+
+    template <typename... Args>
+    static std::shared_ptr<Actor> Create(const std::shared_ptr<Looper>& looper, size_t capacity,
+                                         Args&&... args) {
+        auto actor = std::shared_ptr<Actor>(
+                new Actor(looper, capacity, std::forward<Args>(args)...));
+        actor->task_.SetCallback([weak = std::weak_ptr<Actor>(actor)] {
+            if (auto self = weak.lock()) {
+                self->Drain();
+            }
+        });
+        return actor;
+    }
+
+    // Places the actor on the pool's loopers in turn.
+    template <typename... Args>
+    static std::shared_ptr<Actor> Create(MessageThreadPool& pool, size_t capacity,
+                                         Args&&... args) {
+        return Create(pool.NextLooper(), capacity, std::forward<Args>(args)...);
+    }
+
+    ~Actor() {
+        Mailbox* message;
+        while ((message = Front()) != nullptr) {
+            Pop(message);
+        }
+    }
+
+    Actor(const Actor&) = delete;
+    Actor& operator=(const Actor&) = delete;
+
+  public:
+    // Returns false if the mailbox is full; the message is left untouched in that case.
+    template <typename M>
+    bool Send(M&& message) {
+        auto mask = slots_.size() - 1;
+        auto position = enqueue_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[position & mask];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<int64_t>(sequence - position);
+            if (diff == 0) {
+                if (enqueue_.compare_exchange_weak(position, position + 1,
+                                                   std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        new (slot->storage) Mailbox(std::forward<M>(message));
+        slot->sequence.store(position + 1, std::memory_order_release);
+        task_.Schedule();
+        return true;
+    }
+
+    [[nodiscard]] const std::shared_ptr<Looper>& GetLooper() const { return looper_; }
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        alignas(Mailbox) unsigned char storage[sizeof(Mailbox)];
+    };
+
+    template <typename... Args>
+    Actor(std::shared_ptr<Looper> looper, size_t capacity, Args&&... args)
+        : looper_(std::move(looper)),
+          task_(looper_->GetMessageQueue()),
+          state_(std::forward<Args>(args)...) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots_ = std::vector<Slot>(size);
+        for (size_t i = 0; i < size; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Only the draining looper reads, so the dequeue side needs no compare-and-swap.
+    Mailbox* Front() {
+        auto& slot = slots_[dequeue_ & (slots_.size() - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_ + 1) {
+            return nullptr;
+        }
+        return std::launder(reinterpret_cast<Mailbox*>(slot.storage));
+    }
+
+    void Pop(Mailbox* message) {
+        message->~Mailbox();
+        auto& slot = slots_[dequeue_ & (slots_.size() - 1)];
+        slot.sequence.store(dequeue_ + slots_.size(), std::memory_order_release);
+        ++dequeue_;
+    }
+
+    void Drain() {
+        for (size_t handled = 0; handled < kBatch; ++handled) {
+            auto* message = Front();
+            if (!message) {
+                break;
+            }
+            std::visit([this](auto& m) { state_.Receive(m); }, *message);
+            Pop(message);
+        }
+        if (Front()) {
+            // Batch used up: go to the back of the looper's queue, still scheduled.
+            task_.Requeue();
+            return;
+        }
+        task_.Rearm();
+        if (Front()) {
+            task_.Schedule();
+        }
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    ScheduledTask task_;
+    State state_;
+    std::vector<Slot> slots_;
+
+    alignas(64) std::atomic<uint64_t> enqueue_{0};
+    alignas(64) uint64_t dequeue_ = 0;
+};
+
+}  // namespace mt
@@ -0,0 +1,381 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "bench/alloc_hooks.h"
+#include "bench/bench_util.h"
+#include "buffered_handler.h"
+#include "byte_channel.h"
+#include "thread.h"
+
+/**
+ * Allocation and wakeup accounting for the posting APIs. Every global `operator new/delete` is
+ * counted (see alloc_hooks.h) and wakeups are taken from the voluntary context switches of the
+ * looper thread in /proc/self/task/<tid>/status: each one is a futex wait that had to be woken by
+ * a producer.
+ *
+ *   message_thread_alloc_budget [--messages=N] [--budget-<api>-allocs=X]
+ *                               [--budget-<api>-bytes=X] [--budget-<api>-wakeups=X]
+ *
+ * The process exits with status 1 when any per-message figure exceeds its budget, so it can gate
+ * CI; it is registered as the `alloc_budget` CTest test. Defaults are the current costs of the
+ * implementation (two allocations per post, none per ByteChannel record); tighten them as the hot
+ * path improves. Wakeups are noisier: a burst measures about 2e-4 per message, so the posts allow
+ * 0.005 and the batched APIs 0.01, well under the one per message of an unbatched wakeup. A
+ * ByteChannel writer that finds the ring full yields to the looper, which puts it between 0.01 and
+ * 0.1 on a single core; its budget of 0.25 still catches a wakeup per record.
+ */
+
+namespace mt::bench {
+namespace {
+
+struct Budget {
+    double allocs;
+    double bytes;
+    double wakeups;
+};
+
+struct Usage {
+    double allocs = 0;
+    double bytes = 0;
+    double wakeups = 0;
+};
+
+int64_t VoluntarySwitches(pid_t tid) {
+    std::ifstream status("/proc/self/task/" + std::to_string(tid) + "/status");
+    std::string line;
+    static const std::string kKey = "voluntary_ctxt_switches:";
+    while (std::getline(status, line)) {
+        if (line.compare(0, kKey.size(), kKey) == 0) {
+            return std::stoll(line.substr(kKey.size()));
+        }
+    }
+    return 0;
+}
+
+// Posts a message that records the looper thread's id, and returns the id once the looper has
+// run it and gone idle again.
+pid_t LooperTid(Handler& handler) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    pid_t tid = 0;
+    handler.Post([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        tid = static_cast<pid_t>(syscall(SYS_gettid));
+        cv.notify_all();
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return tid != 0; });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    return tid;
+}
+
+// Holds up the looper until Release(), so that everything posted in between is queued at once.
+class Gate final {
+  public:
+    explicit Gate(Handler& handler) : state_(std::make_shared<State>()) {
+        handler.Post([state = state_] {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cv.wait(lock, [&] { return state->released; });
+        });
+    }
+
+    void Release() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->released = true;
+        state_->cv.notify_all();
+    }
+
+  private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool released = false;
+    };
+
+    // Shared with the gate message, which may still be waking up when the Gate goes away.
+    std::shared_ptr<State> state_;
+};
+
+using PostFunction = std::function<void(Handler&, const std::function<void()>&)>;
+
+/**
+ * Runs `post` `messages` times against a live MessageThread and waits for every message to run;
+ * `flush`, if given, runs after the last post. A warm-up burst of the same size is queued first
+ * while the looper is held up, so that the queue's heap has already grown to hold the measured
+ * burst and its amortized growth does not count. The looper thread is left idle before measuring,
+ * so its wakeups are attributable to the burst.
+ */
+Usage Measure(int64_t messages, const PostFunction& post,
+              const std::function<void()>& flush = nullptr) {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    auto looper_tid = LooperTid(handler);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t executed = 0;
+    // The completion signal is built once so that it does not count towards the budget.
+    std::function<void()> on_executed = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (++executed == messages) {
+            cv.notify_all();
+        }
+    };
+    auto burst = [&](Gate* gate) {
+        for (int64_t i = 0; i < messages; ++i) {
+            post(handler, on_executed);
+        }
+        if (gate) {
+            gate->Release();
+        }
+        if (flush) {
+            flush();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return executed == messages; });
+        executed = 0;
+    };
+
+    Gate gate(handler);
+    burst(&gate);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto switches = VoluntarySwitches(looper_tid);
+    auto before = AllocSnapshot::Take();
+    burst(nullptr);
+    auto delta = AllocSnapshot::Take() - before;
+    switches = VoluntarySwitches(looper_tid) - switches;
+
+    auto n = static_cast<double>(messages);
+    return {static_cast<double>(delta.allocations) / n, static_cast<double>(delta.bytes) / n,
+            static_cast<double>(switches) / n};
+}
+
+/**
+ * Same accounting for 256-byte records written through a ByteChannel by the calling thread. When
+ * the ring is full the producer yields until the consumer frees space.
+ */
+Usage MeasureByteChannel(int64_t messages) {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t executed = 0;
+    auto channel = ByteChannel::Create(thread.GetLooper(), 1 << 16, [&](const uint8_t*, size_t) {
+        if (++executed == messages) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cv.notify_all();
+        }
+    });
+    auto looper_tid = LooperTid(handler);
+
+    uint8_t record[256] = {};
+    auto switches = VoluntarySwitches(looper_tid);
+    auto before = AllocSnapshot::Take();
+    for (int64_t i = 0; i < messages; ++i) {
+        while (!channel->Write(record, sizeof(record))) {
+            std::this_thread::yield();
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return executed == messages; });
+    }
+    auto delta = AllocSnapshot::Take() - before;
+    switches = VoluntarySwitches(looper_tid) - switches;
+
+    auto n = static_cast<double>(messages);
+    return {static_cast<double>(delta.allocations) / n, static_cast<double>(delta.bytes) / n,
+            static_cast<double>(switches) / n};
+}
+
+/**
+ * Cost of posting a message with Handler::PostCancelable() and cancelling it before it runs. The
+ * looper is held up while each burst is posted and cancelled (the first one is a warm-up, as in
+ * Measure()); a final message then confirms that the queue has dropped them all. Cancelling does
+ * not wake the looper.
+ */
+Usage MeasureCancel(int64_t messages) {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    auto looper_tid = LooperTid(handler);
+
+    int64_t ran = 0;
+    auto burst = [&] {
+        Gate gate(handler);
+        for (int64_t i = 0; i < messages; ++i) {
+            handler.PostCancelable([&ran] { ++ran; })->Cancel();
+        }
+        gate.Release();
+        std::promise<void> drained;
+        handler.Post([&drained] { drained.set_value(); });
+        drained.get_future().wait();
+    };
+
+    burst();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto switches = VoluntarySwitches(looper_tid);
+    auto before = AllocSnapshot::Take();
+    burst();
+    auto delta = AllocSnapshot::Take() - before;
+    switches = VoluntarySwitches(looper_tid) - switches;
+    if (ran != 0) {
+        std::fprintf(stderr, "cancel: %lld cancelled messages ran\n", static_cast<long long>(ran));
+        std::exit(1);
+    }
+
+    auto n = static_cast<double>(messages);
+    return {static_cast<double>(delta.allocations) / n, static_cast<double>(delta.bytes) / n,
+            static_cast<double>(switches) / n};
+}
+
+}  // namespace
+}  // namespace mt::bench
+
+int main(int argc, char** argv) {
+    using namespace mt::bench;
+    Args args(argc, argv);
+    auto messages = args.GetInt("messages", 100000);
+
+    struct Api {
+        const char* name;
+        Budget budget;
+        std::function<Usage(int64_t)> measure;
+    };
+    // A small lambda: captures one pointer, like most real callbacks.
+    std::vector<Api> apis = {
+            {"post",
+             {2.05, 114, 0.005},
+             [](int64_t n) {
+                 return Measure(n, [](mt::Handler& handler, const std::function<void()>& done) {
+                     auto* signal = &done;
+                     handler.Post([signal] { (*signal)(); });
+                 });
+             }},
+            {"delayed_post",
+             {2.05, 114, 0.005},
+             [](int64_t n) {
+                 return Measure(n, [](mt::Handler& handler, const std::function<void()>& done) {
+                     auto* signal = &done;
+                     handler.Post([signal] { (*signal)(); }, std::chrono::milliseconds(1));
+                 });
+             }},
+            // The deadline and its expired callback are allocated beside the message.
+            {"deadline_post",
+             {4.05, 178, 0.005},
+             [](int64_t n) {
+                 return Measure(n, [](mt::Handler& handler, const std::function<void()>& done) {
+                     auto* signal = &done;
+                     handler.PostWithDeadline([signal] { (*signal)(); }, [signal] { (*signal)(); },
+                                              mt::TimePoint::max() - std::chrono::hours(1));
+                 });
+             }},
+            {"buffered_post",
+             {2.05, 114, 0.01},
+             [](int64_t n) {
+                 std::unique_ptr<mt::BufferedHandler> buffered;
+                 return Measure(
+                         n,
+                         [&](mt::Handler& handler, const std::function<void()>& done) {
+                             if (!buffered) {
+                                 buffered = std::make_unique<mt::BufferedHandler>(
+                                         handler.GetLooper());
+                             }
+                             auto* signal = &done;
+                             buffered->Post([signal] { (*signal)(); });
+                         },
+                         [&] { buffered->Flush(); });
+             }},
+            // Messages built by the caller and handed over 64 at a time with EnqueueBatch().
+            {"batch_post",
+             {2.05, 114, 0.01},
+             [](int64_t n) {
+                 std::vector<mt::MessagePtr> batch;
+                 batch.reserve(64);
+                 std::shared_ptr<mt::MessageQueue> queue;
+                 auto flush = [&] {
+                     queue->EnqueueBatch(batch);
+                     batch.clear();
+                 };
+                 return Measure(
+                         n,
+                         [&](mt::Handler& handler, const std::function<void()>& done) {
+                             queue = handler.GetLooper()->GetMessageQueue();
+                             auto message = queue->NewMessage();
+                             auto* signal = &done;
+                             message->SetCallback([signal] { (*signal)(); },
+                                                  queue->GetMemoryResource());
+                             message->SetSendTime(queue->GetClock()->Now());
+                             batch.push_back(std::move(message));
+                             if (batch.size() == 64) {
+                                 flush();
+                             }
+                         },
+                         flush);
+             }},
+            {"cancel", {2.05, 114, 0.005}, MeasureCancel},
+            {"byte_channel", {0.01, 1, 0.25}, MeasureByteChannel},
+    };
+
+    JsonWriter json;
+    json.BeginObject();
+    json.Field("benchmark", "message_thread_alloc_budget");
+    json.Field("messages", messages);
+    json.Key("results");
+    json.BeginArray();
+    bool ok = true;
+    for (const auto& api : apis) {
+        auto usage = api.measure(messages);
+        auto name = std::string("budget-") + api.name;
+        Budget budget = {args.GetDouble((name + "-allocs").c_str(), api.budget.allocs),
+                         args.GetDouble((name + "-bytes").c_str(), api.budget.bytes),
+                         args.GetDouble((name + "-wakeups").c_str(), api.budget.wakeups)};
+        bool within = usage.allocs <= budget.allocs && usage.bytes <= budget.bytes &&
+                      usage.wakeups <= budget.wakeups;
+        ok = ok && within;
+
+        json.BeginObject();
+        json.Field("api", api.name);
+        json.Field("allocs_per_msg", usage.allocs);
+        json.Field("bytes_per_msg", usage.bytes);
+        json.Field("wakeups_per_msg", usage.wakeups);
+        json.Field("budget_allocs", budget.allocs);
+        json.Field("budget_bytes", budget.bytes);
+        json.Field("budget_wakeups", budget.wakeups);
+        json.Field("within_budget", within);
+        json.EndObject();
+        if (!within) {
+            std::fprintf(stderr, "%s: over budget (allocs %.3f/%.3f, bytes %.1f/%.1f, "
+                                 "wakeups %.3f/%.3f)\n",
+                         api.name, usage.allocs, budget.allocs, usage.bytes, budget.bytes,
+                         usage.wakeups, budget.wakeups);
+        }
+    }
+    json.EndArray();
+    json.EndObject();
+    json.Finish();
+    return ok ? 0 : 1;
+}
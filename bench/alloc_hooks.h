@@ -0,0 +1,112 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+/**
+ * Replaces the global allocation functions with counting versions. Include this header from
+ * exactly one translation unit of an executable.
+ */
+
+#include <malloc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace mt::bench {
+
+struct AllocCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> deallocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<int64_t> live_bytes{0};
+};
+
+inline AllocCounters& GetAllocCounters() {
+    static AllocCounters counters;
+    return counters;
+}
+
+struct AllocSnapshot {
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    uint64_t bytes = 0;
+    int64_t live_bytes = 0;
+
+    static AllocSnapshot Take() {
+        auto& counters = GetAllocCounters();
+        return {counters.allocations.load(std::memory_order_relaxed),
+                counters.deallocations.load(std::memory_order_relaxed),
+                counters.bytes.load(std::memory_order_relaxed),
+                counters.live_bytes.load(std::memory_order_relaxed)};
+    }
+
+    AllocSnapshot operator-(const AllocSnapshot& other) const {
+        return {allocations - other.allocations, deallocations - other.deallocations,
+                bytes - other.bytes, live_bytes - other.live_bytes};
+    }
+};
+
+inline void* CountedAlloc(void* p) {
+    if (p) {
+        auto size = malloc_usable_size(p);
+        auto& counters = GetAllocCounters();
+        counters.allocations.fetch_add(1, std::memory_order_relaxed);
+        counters.bytes.fetch_add(size, std::memory_order_relaxed);
+        counters.live_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+    return p;
+}
+
+inline void CountedFree(void* p) {
+    if (!p) {
+        return;
+    }
+    auto& counters = GetAllocCounters();
+    counters.deallocations.fetch_add(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_sub(static_cast<int64_t>(malloc_usable_size(p)),
+                                  std::memory_order_relaxed);
+    std::free(p);
+}
+
+inline void* CountedAlignedAlloc(size_t size, std::align_val_t align) {
+    auto alignment = static_cast<size_t>(align);
+    size = (size + alignment - 1) / alignment * alignment;
+    return CountedAlloc(std::aligned_alloc(alignment, size ? size : alignment));
+}
+
+}  // namespace mt::bench
+
+void* operator new(size_t size) {
+    if (void* p = mt::bench::CountedAlloc(std::malloc(size ? size : 1))) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return mt::bench::CountedAlloc(std::malloc(size ? size : 1));
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return mt::bench::CountedAlloc(std::malloc(size ? size : 1));
+}
+void* operator new(size_t size, std::align_val_t align) {
+    if (void* p = mt::bench::CountedAlignedAlloc(size, align)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t align) { return operator new(size, align); }
+
+void operator delete(void* p) noexcept { mt::bench::CountedFree(p); }
+void operator delete[](void* p) noexcept { mt::bench::CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { mt::bench::CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { mt::bench::CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { mt::bench::CountedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { mt::bench::CountedFree(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { mt::bench::CountedFree(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { mt::bench::CountedFree(p); }
@@ -0,0 +1,267 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mt::bench {
+
+using Clock = std::chrono::steady_clock;
+
+inline double SecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+inline int64_t NanosSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+/**
+ * Minimal streaming JSON writer. Produces one document on stdout; benchmarks emit a flat list of
+ * result objects so that the output can be diffed or loaded by a regression tracker.
+ */
+class JsonWriter final {
+  public:
+    explicit JsonWriter(FILE* out = stdout) : out_(out) {}
+    ~JsonWriter() = default;
+
+  public:
+    void BeginObject() { Open('{'); }
+    void EndObject() { Close('}'); }
+    void BeginArray() { Open('['); }
+    void EndArray() { Close(']'); }
+
+    void Key(const char* key) {
+        Separator();
+        std::fprintf(out_, "\"%s\":", key);
+        after_key_ = true;
+    }
+
+    void Value(const std::string& value) {
+        Separator();
+        std::fprintf(out_, "\"%s\"", value.c_str());
+    }
+    void Value(const char* value) { Value(std::string(value)); }
+    void Value(double value) {
+        Separator();
+        std::fprintf(out_, "%.6g", value);
+    }
+    void Value(int64_t value) {
+        Separator();
+        std::fprintf(out_, "%lld", static_cast<long long>(value));
+    }
+    void Value(uint64_t value) {
+        Separator();
+        std::fprintf(out_, "%llu", static_cast<unsigned long long>(value));
+    }
+    void Value(int value) { Value(static_cast<int64_t>(value)); }
+    void Value(bool value) {
+        Separator();
+        std::fputs(value ? "true" : "false", out_);
+    }
+
+    template <typename T>
+    void Field(const char* key, T value) {
+        Key(key);
+        Value(value);
+    }
+
+    void Finish() { std::fputc('\n', out_); }
+
+  private:
+    void Separator() {
+        if (after_key_) {
+            after_key_ = false;
+            return;
+        }
+        if (!first_.empty()) {
+            if (!first_.back()) std::fputc(',', out_);
+            first_.back() = false;
+        }
+    }
+
+    void Open(char c) {
+        Separator();
+        std::fputc(c, out_);
+        first_.push_back(true);
+    }
+
+    void Close(char c) {
+        first_.pop_back();
+        std::fputc(c, out_);
+    }
+
+  private:
+    FILE* out_;
+    bool after_key_ = false;
+    std::vector<bool> first_;
+};
+
+/**
+ * Percentiles over a sample vector. The vector is sorted in place.
+ */
+inline double Percentile(std::vector<int64_t>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    if (!std::is_sorted(samples.begin(), samples.end())) {
+        std::sort(samples.begin(), samples.end());
+    }
+    auto index = static_cast<size_t>(p / 100.0 * static_cast<double>(samples.size() - 1) + 0.5);
+    return static_cast<double>(samples[std::min(index, samples.size() - 1)]);
+}
+
+inline void WritePercentiles(JsonWriter& json, std::vector<int64_t>& samples) {
+    json.Field("p50_ns", Percentile(samples, 50));
+    json.Field("p90_ns", Percentile(samples, 90));
+    json.Field("p99_ns", Percentile(samples, 99));
+    json.Field("p999_ns", Percentile(samples, 99.9));
+    json.Field("max_ns", Percentile(samples, 100));
+}
+
+/**
+ * Log-linear latency histogram in the spirit of HdrHistogram: values below 128 are exact, larger
+ * values keep 6 significant bits (under 1.6% relative error). Recording is O(1) and allocation
+ * free, so it can run inside a message callback.
+ */
+class Histogram final {
+  public:
+    Histogram() : counts_(kBuckets, 0) {}
+    ~Histogram() = default;
+
+  public:
+    void Record(int64_t value) {
+        value = std::max<int64_t>(value, 0);
+        ++counts_[Index(static_cast<uint64_t>(value))];
+        ++total_;
+        max_ = std::max(max_, value);
+    }
+
+    void Merge(const Histogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    [[nodiscard]] uint64_t Count() const { return total_; }
+    [[nodiscard]] int64_t Max() const { return max_; }
+
+    [[nodiscard]] double Percentile(double p) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total_) + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, total_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return static_cast<double>(std::min<int64_t>(Value(i), max_));
+            }
+        }
+        return static_cast<double>(max_);
+    }
+
+  private:
+    static constexpr size_t kSubBuckets = 128;
+    static constexpr size_t kHalf = kSubBuckets / 2;
+    static constexpr size_t kBuckets = kSubBuckets + 57 * kHalf;
+
+    static size_t Index(uint64_t value) {
+        if (value < kSubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        auto shift = static_cast<size_t>(63 - __builtin_clzll(value)) - 6;
+        return kSubBuckets + (shift - 1) * kHalf + static_cast<size_t>((value >> shift) - kHalf);
+    }
+
+    // Upper edge of the bucket, so percentiles never under-report.
+    static int64_t Value(size_t index) {
+        if (index < kSubBuckets) {
+            return static_cast<int64_t>(index);
+        }
+        auto shift = (index - kSubBuckets) / kHalf + 1;
+        auto sub = (index - kSubBuckets) % kHalf + kHalf;
+        return static_cast<int64_t>(((sub + 1) << shift) - 1);
+    }
+
+  private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    int64_t max_ = 0;
+};
+
+/**
+ * Tiny `--name=value` argument parser shared by the benchmark executables.
+ */
+class Args final {
+  public:
+    Args(int argc, char** argv) : args_(argv + 1, argv + argc) {}
+    ~Args() = default;
+
+  public:
+    [[nodiscard]] bool Has(const char* name) const {
+        auto flag = std::string("--") + name;
+        return std::any_of(args_.begin(), args_.end(),
+                           [&](const std::string& arg) { return arg == flag; });
+    }
+
+    [[nodiscard]] std::string Get(const char* name, const std::string& fallback) const {
+        auto prefix = std::string("--") + name + "=";
+        for (const auto& arg : args_) {
+            if (arg.compare(0, prefix.size(), prefix) == 0) {
+                return arg.substr(prefix.size());
+            }
+        }
+        return fallback;
+    }
+
+    [[nodiscard]] int64_t GetInt(const char* name, int64_t fallback) const {
+        auto value = Get(name, "");
+        return value.empty() ? fallback : std::strtoll(value.c_str(), nullptr, 10);
+    }
+
+    [[nodiscard]] double GetDouble(const char* name, double fallback) const {
+        auto value = Get(name, "");
+        return value.empty() ? fallback : std::strtod(value.c_str(), nullptr);
+    }
+
+    [[nodiscard]] std::vector<int64_t> GetIntList(const char* name,
+                                                  std::vector<int64_t> fallback) const {
+        auto value = Get(name, "");
+        if (value.empty()) {
+            return fallback;
+        }
+        std::vector<int64_t> list;
+        const char* cursor = value.c_str();
+        while (*cursor) {
+            char* end = nullptr;
+            list.push_back(std::strtoll(cursor, &end, 10));
+            cursor = *end == ',' ? end + 1 : end;
+            if (end == cursor && *end) break;
+        }
+        return list;
+    }
+
+  private:
+    std::vector<std::string> args_;
+};
+
+}  // namespace mt::bench
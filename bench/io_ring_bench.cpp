@@ -0,0 +1,232 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "io_ring.h"
+#include "thread.h"
+
+/**
+ * Blocking file I/O in callbacks versus IoRing on the same looper. Both modes write `--ops` blocks
+ * to a scratch file with an fdatasync every `--sync-every` writes, while a ticker thread posts a
+ * message every `--tick-us`. The tick latency shows how long the looper was unavailable to other
+ * work: with blocking calls a tick waits behind every pwrite/fdatasync, with IoRing only behind
+ * the submissions and completions.
+ *
+ *   message_thread_io_bench [--ops=4000] [--block=4096] [--depth=32] [--sync-every=64]
+ *                           [--tick-us=200] [--dir=/tmp]
+ */
+
+namespace mt::bench {
+namespace {
+
+struct IoConfig {
+    int64_t ops = 0;
+    int64_t block = 0;
+    int64_t depth = 0;
+    int64_t sync_every = 0;
+    int64_t tick_us = 0;
+    std::string dir;
+};
+
+struct IoResult {
+    double seconds = 0;
+    Histogram tick_latency;
+};
+
+class Done final {
+  public:
+    void Signal() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cv_.notify_all();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return done_; });
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool done_ = false;
+};
+
+/**
+ * Issues the writes of one run on the looper thread, `depth` at a time, and signals once the last
+ * one has completed.
+ */
+class RingWriter final {
+  public:
+    RingWriter(std::shared_ptr<IoRing> ring, int fd, const IoConfig& config, Done& done)
+        : ring_(std::move(ring)), fd_(fd), config_(config), done_(done),
+          buffer_(static_cast<size_t>(config.block), 'x') {}
+
+    void Start() {
+        for (int64_t i = 0; i < config_.depth; ++i) {
+            Issue();
+        }
+    }
+
+  private:
+    void Issue() {
+        if (issued_ == config_.ops) {
+            return;
+        }
+        auto offset = static_cast<uint64_t>(issued_++ * config_.block);
+        ring_->Write(fd_, buffer_.data(), static_cast<uint32_t>(buffer_.size()), offset,
+                     [this](int) { OnWritten(); });
+    }
+
+    void OnWritten() {
+        if (++completed_ == config_.ops) {
+            ring_->Fsync(fd_, [this](int) { done_.Signal(); }, true);
+            return;
+        }
+        if (config_.sync_every > 0 && completed_ % config_.sync_every == 0) {
+            ring_->Fsync(fd_, [this](int) { Issue(); }, true);
+            return;
+        }
+        Issue();
+    }
+
+  private:
+    std::shared_ptr<IoRing> ring_;
+    int fd_;
+    const IoConfig& config_;
+    Done& done_;
+    std::string buffer_;
+    int64_t issued_ = 0;
+    int64_t completed_ = 0;
+};
+
+IoResult RunIo(const IoConfig& config, bool use_ring, bool* supported) {
+    MessageThread thread;
+    auto looper = thread.GetLooper();
+    Handler handler(looper);
+    IoResult result;
+
+    auto path = config.dir + "/message_thread_io_bench." + std::to_string(getpid());
+    int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    unlink(path.c_str());
+    if (fd < 0) {
+        std::perror("open");
+        std::exit(1);
+    }
+
+    std::atomic<bool> ticking{true};
+    std::thread ticker([&] {
+        while (ticking.load(std::memory_order_relaxed)) {
+            auto posted = Clock::now();
+            handler.Post([&, posted] { result.tick_latency.Record(NanosSince(posted)); });
+            std::this_thread::sleep_for(std::chrono::microseconds(config.tick_us));
+        }
+    });
+
+    Done done;
+    std::unique_ptr<RingWriter> writer;
+    std::string buffer(static_cast<size_t>(config.block), 'x');
+    auto start = Clock::now();
+    if (use_ring) {
+        handler.Post([&] {
+            auto ring = IoRing::Create(looper, static_cast<unsigned>(config.depth) * 2);
+            if (!ring) {
+                *supported = false;
+                done.Signal();
+                return;
+            }
+            writer = std::make_unique<RingWriter>(ring, fd, config, done);
+            writer->Start();
+        });
+    } else {
+        for (int64_t i = 0; i < config.ops; ++i) {
+            handler.Post([&, i] {
+                auto offset = static_cast<off_t>(i * config.block);
+                [[maybe_unused]] auto written = pwrite(fd, buffer.data(), buffer.size(), offset);
+                if (i + 1 == config.ops ||
+                    (config.sync_every > 0 && (i + 1) % config.sync_every == 0)) {
+                    fdatasync(fd);
+                }
+                if (i + 1 == config.ops) {
+                    done.Signal();
+                }
+            });
+        }
+    }
+    done.Wait();
+    result.seconds = SecondsSince(start);
+
+    ticking.store(false, std::memory_order_relaxed);
+    ticker.join();
+    // The ring must be released on its looper, after the last tick has been recorded.
+    Done drained;
+    handler.Post([&] {
+        writer.reset();
+        drained.Signal();
+    });
+    drained.Wait();
+    close(fd);
+    return result;
+}
+
+void WriteResult(JsonWriter& json, const char* mode, const IoConfig& config,
+                 const IoResult& result) {
+    json.BeginObject();
+    json.Field("mode", mode);
+    json.Field("ops", config.ops);
+    json.Field("block", config.block);
+    json.Field("seconds", result.seconds);
+    json.Field("ops_per_sec", static_cast<double>(config.ops) / result.seconds);
+    json.Field("ticks", result.tick_latency.Count());
+    json.Field("tick_p50_ns", result.tick_latency.Percentile(50));
+    json.Field("tick_p99_ns", result.tick_latency.Percentile(99));
+    json.Field("tick_max_ns", static_cast<double>(result.tick_latency.Max()));
+    json.EndObject();
+}
+
+}  // namespace
+}  // namespace mt::bench
+
+int main(int argc, char** argv) {
+    using namespace mt::bench;
+    Args args(argc, argv);
+    IoConfig config;
+    config.ops = std::max<int64_t>(1, args.GetInt("ops", 4000));
+    config.block = std::max<int64_t>(1, args.GetInt("block", 4096));
+    config.depth = std::clamp<int64_t>(args.GetInt("depth", 32), 1, 2048);
+    config.sync_every = args.GetInt("sync-every", 64);
+    config.tick_us = std::max<int64_t>(1, args.GetInt("tick-us", 200));
+    config.dir = args.Get("dir", "/tmp");
+
+    JsonWriter json;
+    json.BeginObject();
+    json.Field("benchmark", "message_thread_io_bench");
+    json.Key("results");
+    json.BeginArray();
+    bool supported = true;
+    WriteResult(json, "blocking", config, RunIo(config, false, &supported));
+    auto ring = RunIo(config, true, &supported);
+    if (supported) {
+        WriteResult(json, "io_uring", config, ring);
+    }
+    json.EndArray();
+    json.Field("io_uring_supported", supported);
+    json.EndObject();
+    json.Finish();
+    return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "thread.h"
+
+/**
+ * Open-loop load generator. Producers post into one `MessageThread` at a fixed target rate and the
+ * latency of every message is measured from the time it was *scheduled* to be sent, not the time
+ * the producer actually managed to post it. A producer that falls behind (because posting blocked
+ * or the host stalled it) therefore still charges the delay to the measured latency instead of
+ * silently lowering the offered load, which is the coordinated-omission correction.
+ *
+ *   message_thread_loadgen [--rates=50000,100000,200000] [--duration-ms=2000]
+ *                          [--arrivals=constant|poisson] [--producers=1] [--work-ns=1000]
+ *                          [--knee-factor=10] [--deadline-us=N]
+ *
+ * Each rate in `--rates` is one point of the saturation curve. The knee is reported as the first
+ * rate whose achieved throughput falls below 95% of the target, or whose p99 exceeds
+ * `--knee-factor` times the p99 of the lowest rate.
+ *
+ * With `--deadline-us`, every message expires that long after its scheduled time. Expired messages
+ * are shed by the queue; `useful_rate` counts only the messages that ran in time.
+ */
+
+namespace mt::bench {
+namespace {
+
+struct LoadConfig {
+    double rate = 0;
+    int64_t duration_ms = 0;
+    bool poisson = false;
+    int64_t producers = 1;
+    int64_t work_ns = 0;
+    int64_t deadline_us = 0;
+};
+
+struct LoadResult {
+    double target_rate = 0;
+    double achieved_rate = 0;
+    double useful_rate = 0;
+    uint64_t messages = 0;
+    uint64_t expired = 0;
+    Histogram latency;
+};
+
+void BusyWork(int64_t ns) {
+    if (ns <= 0) {
+        return;
+    }
+    auto until = Clock::now() + std::chrono::nanoseconds(ns);
+    while (Clock::now() < until) {
+    }
+}
+
+void WaitUntil(Clock::time_point when) {
+    auto now = Clock::now();
+    if (when - now > std::chrono::microseconds(200)) {
+        std::this_thread::sleep_until(when - std::chrono::microseconds(100));
+    }
+    while (Clock::now() < when) {
+        std::this_thread::yield();
+    }
+}
+
+LoadResult RunLoad(const LoadConfig& config) {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    LoadResult result;
+    result.target_rate = config.rate;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t executed = 0;
+    std::atomic<uint64_t> posted{0};
+    std::atomic<bool> producers_done{false};
+
+    auto complete = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++executed;
+        if (producers_done.load(std::memory_order_acquire) &&
+            executed == posted.load(std::memory_order_acquire)) {
+            cv.notify_all();
+        }
+    };
+
+    auto start = Clock::now() + std::chrono::milliseconds(10);
+    auto end = start + std::chrono::milliseconds(config.duration_ms);
+    auto per_producer_rate = config.rate / static_cast<double>(config.producers);
+
+    std::vector<std::thread> producers;
+    for (int64_t p = 0; p < config.producers; ++p) {
+        producers.emplace_back([&, p] {
+            std::mt19937_64 rng(static_cast<uint64_t>(p) * 7919 + 1);
+            std::exponential_distribution<double> exponential(per_producer_rate);
+            auto interval = 1.0 / per_producer_rate;
+            // Stagger constant-rate producers so their arrivals interleave evenly.
+            double offset = config.poisson ? exponential(rng)
+                                           : interval * static_cast<double>(p) /
+                                                     static_cast<double>(config.producers);
+            while (true) {
+                auto intended = start + std::chrono::duration_cast<Clock::duration>(
+                                                std::chrono::duration<double>(offset));
+                if (intended >= end) {
+                    break;
+                }
+                WaitUntil(intended);
+                auto run = [&, intended] {
+                    BusyWork(config.work_ns);
+                    result.latency.Record(NanosSince(intended));
+                    complete();
+                };
+                if (config.deadline_us > 0) {
+                    // Shed messages still complete the run, but record no latency.
+                    handler.PostWithDeadline(
+                            run, [&] { complete(); },
+                            intended + std::chrono::microseconds(config.deadline_us));
+                } else {
+                    handler.Post(run);
+                }
+                posted.fetch_add(1, std::memory_order_release);
+                offset += config.poisson ? exponential(rng) : interval;
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        producers_done.store(true, std::memory_order_release);
+        cv.wait(lock, [&] { return executed == posted.load(std::memory_order_acquire); });
+    }
+
+    result.messages = posted.load();
+    result.expired = thread.GetLooper()->GetMessageQueue()->GetExpiredCount();
+    auto seconds = SecondsSince(start);
+    result.achieved_rate = static_cast<double>(result.messages) / seconds;
+    result.useful_rate = static_cast<double>(result.messages - result.expired) / seconds;
+    return result;
+}
+
+void WriteResult(JsonWriter& json, const LoadConfig& config, const LoadResult& result) {
+    static constexpr double kSpectrum[] = {0,    25,   50,    75,     90,      95, 99,
+                                           99.5, 99.9, 99.95, 99.99, 99.999, 100};
+    json.BeginObject();
+    json.Field("target_rate", result.target_rate);
+    json.Field("achieved_rate", result.achieved_rate);
+    json.Field("useful_rate", result.useful_rate);
+    json.Field("messages", result.messages);
+    json.Field("expired", result.expired);
+    json.Field("producers", config.producers);
+    json.Field("work_ns", config.work_ns);
+    json.Key("latency_ns");
+    json.BeginArray();
+    for (auto p : kSpectrum) {
+        json.BeginObject();
+        json.Field("percentile", p);
+        json.Field("value", result.latency.Percentile(p));
+        json.EndObject();
+    }
+    json.EndArray();
+    json.EndObject();
+}
+
+}  // namespace
+}  // namespace mt::bench
+
+int main(int argc, char** argv) {
+    using namespace mt::bench;
+    Args args(argc, argv);
+    LoadConfig config;
+    config.duration_ms = args.GetInt("duration-ms", 2000);
+    config.poisson = args.Get("arrivals", "constant") == "poisson";
+    config.producers = std::max<int64_t>(1, args.GetInt("producers", 1));
+    config.work_ns = args.GetInt("work-ns", 1000);
+    config.deadline_us = args.GetInt("deadline-us", 0);
+    auto rates = args.GetIntList("rates", {50000, 100000, 200000, 400000});
+    auto knee_factor = args.GetDouble("knee-factor", 10);
+
+    JsonWriter json;
+    json.BeginObject();
+    json.Field("benchmark", "message_thread_loadgen");
+    json.Field("arrivals", config.poisson ? "poisson" : "constant");
+    json.Field("duration_ms", config.duration_ms);
+    json.Key("curve");
+    json.BeginArray();
+    double baseline_p99 = 0;
+    double knee = 0;
+    for (auto rate : rates) {
+        config.rate = static_cast<double>(rate);
+        auto result = RunLoad(config);
+        WriteResult(json, config, result);
+        auto p99 = result.latency.Percentile(99);
+        if (baseline_p99 == 0) {
+            baseline_p99 = std::max(p99, 1.0);
+        }
+        if (knee == 0 && (result.achieved_rate < 0.95 * config.rate ||
+                          p99 > knee_factor * baseline_p99)) {
+            knee = config.rate;
+        }
+    }
+    json.EndArray();
+    json.Field("knee_rate", knee);
+    json.EndObject();
+    json.Finish();
+    return 0;
+}
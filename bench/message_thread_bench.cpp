@@ -0,0 +1,401 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench/alloc_hooks.h"
+#include "bench/bench_util.h"
+#include "buffered_handler.h"
+#include "huge_page_arena.h"
+#include "multicast_ring.h"
+#include "thread.h"
+
+/**
+ * Microbenchmarks for the message-thread hot paths. Every result is written as one JSON document
+ * on stdout:
+ *
+ *   message_thread_bench [--messages=N] [--producers=1,2,4,8] [--round-trips=N]
+ *                        [--backlogs=0,1000,100000] [--ops=N] [--pending=N]
+ *                        [--noisy-backlog=N] [--fanout-consumers=4]
+ *                        [--timer-threads=8,16,32,64] [--timer-inserts=N]
+ */
+
+namespace mt::bench {
+namespace {
+
+/**
+ * Counts executed messages and wakes the waiter once `target` of them have run.
+ */
+class Countdown final {
+  public:
+    explicit Countdown(int64_t target) : remaining_(target) {}
+    ~Countdown() = default;
+
+  public:
+    void CountDown() {
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return remaining_.load(std::memory_order_acquire) <= 0; });
+    }
+
+  private:
+    std::atomic<int64_t> remaining_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+// With `buffered`, producers post through a BufferedHandler and flush once at the end.
+void BenchPostThroughput(JsonWriter& json, int64_t messages, int64_t producers, bool buffered) {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    BufferedHandler buffered_handler(thread.GetLooper());
+    Countdown done(messages);
+
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int64_t p = 0; p < producers; ++p) {
+        auto count = messages / producers + (p < messages % producers ? 1 : 0);
+        threads.emplace_back([&handler, &buffered_handler, &done, count, buffered] {
+            for (int64_t i = 0; i < count; ++i) {
+                if (buffered) {
+                    buffered_handler.Post([&done] { done.CountDown(); });
+                } else {
+                    handler.Post([&done] { done.CountDown(); });
+                }
+            }
+            buffered_handler.Flush();
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto post_seconds = SecondsSince(start);
+    done.Wait();
+    auto seconds = SecondsSince(start);
+
+    json.BeginObject();
+    json.Field("name", "post_throughput");
+    json.Field("mode", buffered ? "buffered" : "direct");
+    json.Field("producers", producers);
+    json.Field("messages", messages);
+    json.Field("post_seconds", post_seconds);
+    // Time each producer spends per post; grows with contention on the queue's shared lines.
+    json.Field("post_ns_per_msg", post_seconds * 1e9 * static_cast<double>(producers) /
+                                          static_cast<double>(messages));
+    json.Field("seconds", seconds);
+    json.Field("msgs_per_sec", static_cast<double>(messages) / seconds);
+    json.Field("ns_per_msg", seconds * 1e9 / static_cast<double>(messages));
+    json.EndObject();
+}
+
+void BenchPingPong(JsonWriter& json, int64_t round_trips) {
+    MessageThread ping;
+    MessageThread pong;
+    Handler ping_handler(ping.GetLooper());
+    Handler pong_handler(pong.GetLooper());
+
+    std::vector<int64_t> samples;
+    samples.reserve(static_cast<size_t>(round_trips));
+    Countdown done(1);
+
+    // Each round trip is a post to `pong` that posts back to `ping`; the next round trip starts
+    // from the `ping` thread as soon as the previous one lands.
+    std::function<void()> serve = [&] {
+        auto start = Clock::now();
+        pong_handler.Post([&, start] {
+            ping_handler.Post([&, start] {
+                samples.push_back(NanosSince(start));
+                if (static_cast<int64_t>(samples.size()) < round_trips) {
+                    serve();
+                } else {
+                    done.CountDown();
+                }
+            });
+        });
+    };
+    auto start = Clock::now();
+    ping_handler.Post([&] { serve(); });
+    done.Wait();
+    auto seconds = SecondsSince(start);
+
+    json.BeginObject();
+    json.Field("name", "ping_pong_round_trip");
+    json.Field("round_trips", round_trips);
+    json.Field("seconds", seconds);
+    json.Field("mean_ns", seconds * 1e9 / static_cast<double>(round_trips));
+    WritePercentiles(json, samples);
+    json.EndObject();
+}
+
+// With `arena`, messages and heap arrays come from a HugePageArena instead of the heap.
+void BenchDelayedInsertPop(JsonWriter& json, int64_t backlog, int64_t ops, bool arena) {
+    std::shared_ptr<std::pmr::memory_resource> resource;
+#if defined(__linux__)
+    if (arena) resource = std::make_shared<HugePageArena>();
+#endif
+    MessageQueue queue(SteadyClock::Instance(), resource);
+    for (int64_t i = 0; i < backlog; ++i) {
+        auto message = queue.NewMessage();
+        message->SetCallback([] {}, queue.GetMemoryResource());
+        message->SetSendTime(Clock::now() + std::chrono::hours(1) +
+                             std::chrono::milliseconds(i % 1000));
+        queue.Enqueue(message);
+    }
+
+    // Messages are prepared up front so only the heap insert and pop are timed.
+    std::vector<MessagePtr> messages(static_cast<size_t>(ops));
+    for (auto& message : messages) {
+        message = queue.NewMessage();
+        message->SetCallback([] {}, queue.GetMemoryResource());
+        message->SetSendTime(Clock::now());
+    }
+
+    auto start = Clock::now();
+    for (const auto& message : messages) {
+        queue.Enqueue(message);
+    }
+    auto insert_ns = NanosSince(start);
+
+    start = Clock::now();
+    for (int64_t i = 0; i < ops; ++i) {
+        queue.Next();
+    }
+    auto pop_ns = NanosSince(start);
+
+    json.BeginObject();
+    json.Field("name", "delayed_insert_pop");
+    json.Field("allocator", arena ? "huge_page_arena" : "heap");
+    json.Field("backlog", backlog);
+    json.Field("ops", ops);
+    json.Field("insert_ns_per_op", static_cast<double>(insert_ns) / static_cast<double>(ops));
+    json.Field("pop_ns_per_op", static_cast<double>(pop_ns) / static_cast<double>(ops));
+    json.EndObject();
+}
+
+// `threads` threads schedule timers into one queue at once, with the plain mutex and with flat
+// combining. Timers are an hour out and spread over a second, so nothing becomes due and every
+// insert is a heap sift into a growing heap.
+void BenchTimerInsert(JsonWriter& json, int64_t threads, int64_t inserts) {
+    for (bool combining : {false, true}) {
+        MessageQueue queue;
+        if (combining) queue.EnableFlatCombining();
+        auto per_thread = std::max<int64_t>(inserts / threads, 1);
+        std::vector<std::vector<MessagePtr>> messages(static_cast<size_t>(threads));
+        auto base = Clock::now() + std::chrono::hours(1);
+        for (int64_t t = 0; t < threads; ++t) {
+            for (int64_t i = 0; i < per_thread; ++i) {
+                auto message = std::make_shared<Message>();
+                message->SetSendTime(base + std::chrono::microseconds((i * 7919 + t * 104729) %
+                                                                      1000000));
+                messages[static_cast<size_t>(t)].push_back(std::move(message));
+            }
+        }
+
+        std::atomic<int64_t> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> workers;
+        for (int64_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                for (const auto& message : messages[static_cast<size_t>(t)]) {
+                    queue.Enqueue(message);
+                }
+            });
+        }
+        while (ready.load() < threads) {
+            std::this_thread::yield();
+        }
+        auto start = Clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto seconds = SecondsSince(start);
+        auto total = per_thread * threads;
+
+        json.BeginObject();
+        json.Field("name", "timer_insert");
+        json.Field("mode", combining ? "flat_combining" : "locking");
+        json.Field("threads", threads);
+        json.Field("inserts", total);
+        json.Field("inserts_per_sec", static_cast<double>(total) / seconds);
+        json.Field("ns_per_insert", seconds * 1e9 / static_cast<double>(total));
+        json.EndObject();
+    }
+}
+
+void BenchMemoryPerPendingMessage(JsonWriter& json, int64_t pending) {
+    // The looper is never run, so every posted message stays pending.
+    auto looper = std::make_shared<Looper>();
+    Handler handler(looper);
+
+    auto before = AllocSnapshot::Take();
+    for (int64_t i = 0; i < pending; ++i) {
+        handler.Post([i] { (void)i; }, std::chrono::hours(1));
+    }
+    auto delta = AllocSnapshot::Take() - before;
+
+    json.BeginObject();
+    json.Field("name", "memory_per_pending_message");
+    json.Field("pending", pending);
+    json.Field("live_bytes", delta.live_bytes);
+    json.Field("bytes_per_message",
+               static_cast<double>(delta.live_bytes) / static_cast<double>(pending));
+    json.Field("allocations_per_message",
+               static_cast<double>(delta.allocations - delta.deallocations) /
+                       static_cast<double>(pending));
+    json.EndObject();
+}
+
+// Latency of one quiet-tenant message posted behind `backlog` messages of a noisy tenant, with
+// both tenants in the shared default sub-queue and with a sub-queue each.
+void BenchFairQueuing(JsonWriter& json, int64_t backlog) {
+    for (bool fair : {false, true}) {
+        MessageThread thread;
+        auto looper = thread.GetLooper();
+        Handler noisy = fair ? Handler(looper, 1) : Handler(looper);
+        Handler quiet = fair ? Handler(looper, 1) : Handler(looper);
+
+        // Hold the looper until the backlog is queued so that both modes start from the same state.
+        std::mutex gate;
+        gate.lock();
+        noisy.Post([&gate] { std::lock_guard<std::mutex> lock(gate); });
+        for (int64_t i = 0; i < backlog; ++i) {
+            noisy.Post([] {});
+        }
+        Countdown done(1);
+        int64_t latency_ns = 0;
+        auto start = Clock::now();
+        quiet.Post([&] {
+            latency_ns = NanosSince(start);
+            done.CountDown();
+        });
+        gate.unlock();
+        done.Wait();
+
+        json.BeginObject();
+        json.Field("name", "fair_queuing_quiet_latency");
+        json.Field("mode", fair ? "sub_queue_per_handler" : "shared_queue");
+        json.Field("noisy_backlog", backlog);
+        json.Field("latency_ns", latency_ns);
+        json.EndObject();
+    }
+}
+
+/**
+ * Delivers `events` 64-byte events to `consumers` MessageThreads, once by posting a copy to each
+ * and once through a MulticastRing that every consumer reads in place.
+ */
+void BenchFanout(JsonWriter& json, int64_t events, int64_t consumers) {
+    struct Event {
+        int64_t sequence;
+        char payload[56];
+    };
+    for (bool ring_mode : {false, true}) {
+        std::vector<std::unique_ptr<MessageThread>> threads;
+        std::vector<std::unique_ptr<Handler>> handlers;
+        for (int64_t i = 0; i < consumers; ++i) {
+            threads.push_back(std::make_unique<MessageThread>());
+            handlers.push_back(std::make_unique<Handler>(threads.back()->GetLooper()));
+        }
+        Countdown done(consumers);
+        std::vector<int64_t> sums(static_cast<size_t>(consumers), 0);
+        auto ring = MulticastRing<Event>::Create(4096);
+        for (int64_t i = 0; i < consumers && ring_mode; ++i) {
+            auto* sum = &sums[static_cast<size_t>(i)];
+            ring->AddConsumer(threads[static_cast<size_t>(i)]->GetLooper(),
+                              [&, sum](const Event& event, int64_t, bool) {
+                                  *sum += event.sequence;
+                                  if (event.sequence == events - 1) done.CountDown();
+                              });
+        }
+
+        auto start = Clock::now();
+        for (int64_t e = 0; e < events; ++e) {
+            if (ring_mode) {
+                ring->Publish([e](Event& event) { event.sequence = e; });
+                continue;
+            }
+            Event event{e, {}};
+            for (int64_t i = 0; i < consumers; ++i) {
+                auto* sum = &sums[static_cast<size_t>(i)];
+                handlers[static_cast<size_t>(i)]->Post([&, sum, event] {
+                    *sum += event.sequence;
+                    if (event.sequence == events - 1) done.CountDown();
+                });
+            }
+        }
+        done.Wait();
+        auto seconds = SecondsSince(start);
+
+        json.BeginObject();
+        json.Field("name", "fanout");
+        json.Field("mode", ring_mode ? "multicast_ring" : "post_per_consumer");
+        json.Field("consumers", consumers);
+        json.Field("events", events);
+        json.Field("events_per_sec", static_cast<double>(events) / seconds);
+        json.EndObject();
+    }
+}
+
+}  // namespace
+}  // namespace mt::bench
+
+int main(int argc, char** argv) {
+    using namespace mt::bench;
+    Args args(argc, argv);
+    auto messages = args.GetInt("messages", 200000);
+    auto producers = args.GetIntList("producers", {1, 2, 4, 8});
+    auto round_trips = args.GetInt("round-trips", 20000);
+    auto backlogs = args.GetIntList("backlogs", {0, 1000, 100000, 1000000});
+    auto ops = args.GetInt("ops", 100000);
+    auto pending = args.GetInt("pending", 100000);
+
+    JsonWriter json;
+    json.BeginObject();
+    json.Field("benchmark", "message_thread_bench");
+    json.Key("results");
+    json.BeginArray();
+    for (auto p : producers) {
+        BenchPostThroughput(json, messages, p, false);
+        BenchPostThroughput(json, messages, p, true);
+    }
+    BenchPingPong(json, round_trips);
+    for (auto backlog : backlogs) {
+        BenchDelayedInsertPop(json, backlog, ops, false);
+#if defined(__linux__)
+        BenchDelayedInsertPop(json, backlog, ops, true);
+#endif
+    }
+    for (auto threads : args.GetIntList("timer-threads", {8, 16, 32, 64})) {
+        BenchTimerInsert(json, std::max<int64_t>(threads, 1), args.GetInt("timer-inserts", 400000));
+    }
+    BenchMemoryPerPendingMessage(json, pending);
+    BenchFairQueuing(json, args.GetInt("noisy-backlog", 100000));
+    BenchFanout(json, messages, args.GetInt("fanout-consumers", 4));
+    json.EndArray();
+    json.EndObject();
+    json.Finish();
+    return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_util.h"
+#include "numa.h"
+#include "thread.h"
+
+/**
+ * Local versus remote dispatch on a NumaLooperPool. A producer on node 0 posts to a looper on its
+ * own node and to one on the last node; the round trip is a ping from a node-0 looper answered by
+ * the target looper. Each message in the throughput run carries a 64-byte payload in its callback,
+ * allocated from the target node's memory. On a single-node machine the nodes are simulated by
+ * splitting the CPUs (`--simulate=N` forces this), which shows the cross-core part of the cost but
+ * not remote memory.
+ *
+ *   message_thread_numa_bench [--messages=200000] [--round-trips=20000] [--simulate=2]
+ */
+
+namespace mt::bench {
+namespace {
+
+using Payload = std::array<uint64_t, 8>;
+
+class Done final {
+  public:
+    void Signal() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cv_.notify_all();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return done_; });
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool done_ = false;
+};
+
+void Pin(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void BenchThroughput(JsonWriter& json, NumaLooperPool& pool, const char* mode, size_t target_node,
+                     int64_t messages) {
+    Handler handler(pool.GetLooper(target_node, 0));
+    Done done;
+    uint64_t sum = 0;
+    int64_t received = 0;
+
+    auto start = Clock::now();
+    std::thread producer([&] {
+        Pin(pool.GetTopology().Cpus(0));
+        for (int64_t i = 0; i < messages; ++i) {
+            Payload payload;
+            payload.fill(static_cast<uint64_t>(i));
+            handler.Post([&, payload] {
+                for (auto value : payload) sum += value;
+                if (++received == messages) done.Signal();
+            });
+        }
+    });
+    producer.join();
+    done.Wait();
+    auto seconds = SecondsSince(start);
+
+    json.BeginObject();
+    json.Field("name", "numa_post_throughput");
+    json.Field("mode", mode);
+    json.Field("target_node", static_cast<int64_t>(target_node));
+    json.Field("messages", messages);
+    json.Field("seconds", seconds);
+    json.Field("msgs_per_sec", static_cast<double>(messages) / seconds);
+    json.Field("ns_per_msg", seconds * 1e9 / static_cast<double>(messages));
+    json.Field("checksum", sum);
+    json.EndObject();
+}
+
+void BenchRoundTrip(JsonWriter& json, NumaLooperPool& pool, const char* mode,
+                    const std::shared_ptr<Looper>& target, int64_t round_trips) {
+    Handler ping_handler(pool.GetLooper(0, 0));
+    Handler pong_handler(target);
+
+    std::vector<int64_t> samples;
+    samples.reserve(static_cast<size_t>(round_trips));
+    Done done;
+
+    std::function<void()> serve = [&] {
+        auto start = Clock::now();
+        pong_handler.Post([&, start] {
+            ping_handler.Post([&, start] {
+                samples.push_back(NanosSince(start));
+                if (static_cast<int64_t>(samples.size()) < round_trips) {
+                    serve();
+                } else {
+                    done.Signal();
+                }
+            });
+        });
+    };
+    auto start = Clock::now();
+    ping_handler.Post([&] { serve(); });
+    done.Wait();
+    auto seconds = SecondsSince(start);
+
+    json.BeginObject();
+    json.Field("name", "numa_round_trip");
+    json.Field("mode", mode);
+    json.Field("round_trips", round_trips);
+    json.Field("mean_ns", seconds * 1e9 / static_cast<double>(round_trips));
+    WritePercentiles(json, samples);
+    json.EndObject();
+}
+
+}  // namespace
+}  // namespace mt::bench
+
+int main(int argc, char** argv) {
+    using namespace mt::bench;
+    Args args(argc, argv);
+    auto messages = std::max<int64_t>(1, args.GetInt("messages", 200000));
+    auto round_trips = std::max<int64_t>(1, args.GetInt("round-trips", 20000));
+    auto simulate = args.GetInt("simulate", 0);
+
+    auto topology = mt::NumaTopology::Detect();
+    if (simulate > 1 || topology.NodeCount() < 2) {
+        topology = mt::NumaTopology::Simulate(static_cast<size_t>(std::max<int64_t>(simulate, 2)));
+    }
+    // Two loopers per node, so that the local round trip also crosses threads.
+    mt::NumaLooperPool pool(2, topology);
+    auto remote_node = pool.NodeCount() - 1;
+
+    JsonWriter json;
+    json.BeginObject();
+    json.Field("benchmark", "message_thread_numa_bench");
+    json.Field("nodes", static_cast<int64_t>(pool.NodeCount()));
+    json.Field("simulated", topology.IsSimulated());
+    json.Key("results");
+    json.BeginArray();
+    BenchThroughput(json, pool, "local", 0, messages);
+    BenchThroughput(json, pool, "remote", remote_node, messages);
+    BenchRoundTrip(json, pool, "local", pool.GetLooper(0, 1), round_trips);
+    BenchRoundTrip(json, pool, "remote", pool.GetLooper(remote_node, 0), round_trips);
+    json.EndArray();
+    json.EndObject();
+    json.Finish();
+    pool.Braking();
+    return 0;
+}
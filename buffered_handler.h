@@ -0,0 +1,198 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * A Handler for producers that post many small messages to one looper. Posts are collected in a
+ * buffer private to the posting thread and handed to the queue in one batch (one lock acquisition,
+ * one wakeup) when the buffer is full, on Flush(), or once its oldest message has waited
+ * `max_linger`. Messages from one thread keep their order; messages from different threads, or
+ * from this and a plain Handler, are only ordered by when their batches are published.
+ *
+ * The linger limit is enforced by a timer message on the target looper, armed at most once per
+ * linger period. A thread's buffer is published when the thread exits. Copies share buffers; once
+ * the last copy is destroyed, other threads' buffers are left to their timers and released the
+ * next time their thread starts using another BufferedHandler.
+ */
+class BufferedHandler final {
+  public:
+    explicit BufferedHandler(const std::shared_ptr<Looper>& looper, size_t capacity = 64,
+                             std::chrono::microseconds max_linger = std::chrono::microseconds(100))
+        : looper_(looper),
+          capacity_(std::max<size_t>(capacity, 1)),
+          max_linger_(max_linger),
+          id_(NextId()),
+          alive_(std::make_shared<bool>(true)) {}
+
+    ~BufferedHandler() = default;
+
+  public:
+    // Returns false if a batch published by this call was rejected because the queue has quit.
+    template <typename F>
+    bool Post(F f, std::chrono::milliseconds delay = std::chrono::milliseconds(0)) const {
+        const auto& queue = looper_->GetMessageQueue();
+        auto message = queue->NewMessage();
+        message->SetCallback(std::forward<F>(f), queue->GetMemoryResource());
+        auto now = queue->GetClock()->Now();
+        message->SetSendTime(now + delay);
+        return LocalBuffer().Add(message, now);
+    }
+
+    // Publishes the calling thread's buffered messages now. Returns false if the queue has quit.
+    bool Flush() const { return LocalBuffer().Publish(); }
+
+    [[nodiscard]] const std::shared_ptr<Looper>& GetLooper() const { return looper_; }
+
+  private:
+    class Buffer final : public std::enable_shared_from_this<Buffer> {
+      public:
+        Buffer(std::shared_ptr<MessageQueue> queue, size_t capacity,
+               std::chrono::microseconds max_linger)
+            : queue_(std::move(queue)),
+              capacity_(capacity),
+              max_linger_(std::chrono::duration_cast<TimePoint::duration>(max_linger)),
+              timer_(std::make_shared<Message>()) {
+            messages_.reserve(capacity_);
+        }
+
+        // Runs at thread exit.
+        ~Buffer() { Publish(); }
+
+        void Init() {
+            timer_->SetAsynchronous(true);
+            timer_->SetCallback([weak = weak_from_this()] {
+                if (auto buffer = weak.lock()) buffer->OnTimer();
+            });
+        }
+
+        bool Add(const MessagePtr& message, TimePoint now) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (messages_.empty()) {
+                first_time_ = now;
+            }
+            messages_.push_back(message);
+            if (messages_.size() >= capacity_) {
+                return PublishLocked();
+            }
+            if (!timer_armed_) {
+                ArmTimer(first_time_ + max_linger_);
+            }
+            return true;
+        }
+
+        bool Publish() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return PublishLocked();
+        }
+
+      private:
+        // Publishing under the buffer lock keeps this thread's batches in order.
+        bool PublishLocked() {
+            if (messages_.empty()) {
+                return true;
+            }
+            auto accepted = queue_->EnqueueBatch(messages_);
+            messages_.clear();
+            return accepted;
+        }
+
+        void ArmTimer(TimePoint time) {
+            timer_->SetSendTime(time);
+            timer_armed_ = queue_->Enqueue(timer_);
+        }
+
+        // On the looper: publishes a buffer that has lingered long enough, or re-arms for the
+        // messages that arrived since the last batch.
+        void OnTimer() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            timer_armed_ = false;
+            if (messages_.empty()) {
+                return;
+            }
+            if (queue_->GetClock()->Now() - first_time_ >= max_linger_) {
+                PublishLocked();
+            } else {
+                ArmTimer(first_time_ + max_linger_);
+            }
+        }
+
+      private:
+        std::shared_ptr<MessageQueue> queue_;
+        size_t capacity_;
+        TimePoint::duration max_linger_;
+        std::mutex mutex_;
+        std::vector<MessagePtr> messages_;
+        TimePoint first_time_;
+        // Reused for every arming, so the linger limit costs no allocation per batch.
+        MessagePtr timer_;
+        bool timer_armed_ = false;
+    };
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next_id{1};
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct LocalEntry {
+        // Expires with the last copy of the handler that owns the buffer.
+        std::weak_ptr<bool> alive;
+        std::shared_ptr<Buffer> buffer;
+    };
+
+    Buffer& LocalBuffer() const {
+        // The last buffer used by this thread is cached, so a producer that sticks to one handler
+        // skips the map lookup. The cached handler is the caller, so its entry is never pruned.
+        static thread_local std::unordered_map<uint64_t, LocalEntry> buffers;
+        static thread_local uint64_t cached_id = 0;
+        static thread_local Buffer* cached = nullptr;
+        if (cached_id == id_) {
+            return *cached;
+        }
+        auto it = buffers.find(id_);
+        if (it == buffers.end()) {
+            // Drop the buffers of destroyed handlers (publishing what they hold) before adding
+            // one, so the map only grows with the number of live handlers this thread has used.
+            for (auto entry = buffers.begin(); entry != buffers.end();) {
+                entry = entry->second.alive.expired() ? buffers.erase(entry) : std::next(entry);
+            }
+            auto buffer =
+                    std::make_shared<Buffer>(looper_->GetMessageQueue(), capacity_, max_linger_);
+            buffer->Init();
+            it = buffers.emplace(id_, LocalEntry{alive_, std::move(buffer)}).first;
+        }
+        cached_id = id_;
+        cached = it->second.buffer.get();
+        return *cached;
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    size_t capacity_;
+    std::chrono::microseconds max_linger_;
+    uint64_t id_;
+    // Shared by copies; LocalBuffer() entries hold it weakly.
+    std::shared_ptr<bool> alive_;
+};
+
+}  // namespace mt
@@ -0,0 +1,210 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * A single-producer, single-consumer ring of variable-size byte records delivered to a Looper.
+ * The producer reserves space, writes the record in place and commits it; the consumer's callback
+ * reads it in place on the looper thread, and the space is reused once the callback returns. No
+ * record allocates: the ring is one contiguous buffer and the consumer is notified through a
+ * single reused message, which is only enqueued when the consumer is not already scheduled.
+ *
+ * A record never wraps around the end of the buffer, so the consumer always sees one contiguous
+ * span; a record that does not fit before the end skips to the start. Records may therefore be at
+ * most half the capacity.
+ *
+ * Reserve()/Commit()/Write() must be called from one producer thread at a time. When a reservation
+ * fails for lack of space, the optional writable callback runs on `producer_looper` once the
+ * consumer has freed some.
+ */
+class ByteChannel final {
+  public:
+    using RecordCallback = std::function<void(const uint8_t* data, size_t size)>;
+
+    // `capacity` is rounded up to a power of two.
+    static std::shared_ptr<ByteChannel> Create(std::shared_ptr<Looper> consumer_looper,
+                                               size_t capacity, RecordCallback on_record,
+                                               std::shared_ptr<Looper> producer_looper = nullptr,
+                                               std::function<void()> on_writable = nullptr) {
+        auto channel = std::shared_ptr<ByteChannel>(new ByteChannel(
+                std::move(consumer_looper), capacity, std::move(on_record)));
+        std::weak_ptr<ByteChannel> weak = channel;
+        channel->drain_.SetCallback([weak] {
+            if (auto self = weak.lock()) {
+                self->Drain();
+            }
+        });
+        if (producer_looper && on_writable) {
+            channel->producer_queue_ = producer_looper->GetMessageQueue();
+            channel->writable_message_ = std::make_shared<Message>();
+            channel->writable_message_->SetCallback(std::move(on_writable));
+        }
+        return channel;
+    }
+
+    ~ByteChannel() = default;
+
+    ByteChannel(const ByteChannel&) = delete;
+    ByteChannel& operator=(const ByteChannel&) = delete;
+
+  public:
+    // Returns `size` writable bytes in the ring, or nullptr if there is not enough free space (or
+    // `size` exceeds MaxRecordSize()). The record becomes visible to the consumer on Commit().
+    uint8_t* Reserve(size_t size) {
+        if (size > MaxRecordSize()) {
+            return nullptr;
+        }
+        auto total = RecordSpan(size);
+        auto offset = tail_ & mask_;
+        auto skip = capacity_ - offset < total ? capacity_ - offset : 0;
+        if (!HasSpace(skip + total)) {
+            want_space_.store(true, std::memory_order_relaxed);
+            // Re-checked after raising the flag, in case the consumer drained in between.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!HasSpace(skip + total)) {
+                return nullptr;
+            }
+            want_space_.store(false, std::memory_order_relaxed);
+        }
+        if (skip > 0) {
+            StoreLength(offset, kSkip);
+            tail_ += skip;
+            offset = 0;
+        }
+        reserved_ = size;
+        return buffer_.data() + offset + kHeader;
+    }
+
+    // Publishes the reserved record, shrunk to `size` if fewer bytes were written.
+    void Commit(size_t size) {
+        size = std::min(size, reserved_);
+        StoreLength(tail_ & mask_, static_cast<uint32_t>(size));
+        tail_ += RecordSpan(size);
+        reserved_ = 0;
+        published_.store(tail_, std::memory_order_release);
+        drain_.Schedule();
+    }
+
+    // Reserve, copy and commit in one call. Returns false if the ring is full.
+    bool Write(const void* data, size_t size) {
+        auto* destination = Reserve(size);
+        if (!destination) {
+            return false;
+        }
+        if (size > 0) {
+            std::memcpy(destination, data, size);
+        }
+        Commit(size);
+        return true;
+    }
+
+    [[nodiscard]] size_t MaxRecordSize() const { return capacity_ / 2 - kHeader; }
+
+  private:
+    // Each record starts with its length, and records are 8-byte aligned.
+    static constexpr size_t kHeader = 8;
+    static constexpr uint32_t kSkip = UINT32_MAX;
+
+    // Records handled per consumer turn before other messages on the looper get to run.
+    static constexpr size_t kBatch = 256;
+
+    ByteChannel(std::shared_ptr<Looper> looper, size_t capacity, RecordCallback on_record)
+        : drain_(looper->GetMessageQueue()), on_record_(std::move(on_record)) {
+        capacity_ = 64;
+        while (capacity_ < capacity) capacity_ <<= 1;
+        mask_ = capacity_ - 1;
+        buffer_.resize(capacity_);
+    }
+
+    static size_t RecordSpan(size_t size) { return (kHeader + size + 7) & ~size_t{7}; }
+
+    bool HasSpace(size_t bytes) {
+        if (capacity_ - (tail_ - head_cache_) >= bytes) {
+            return true;
+        }
+        head_cache_ = consumed_.load(std::memory_order_acquire);
+        return capacity_ - (tail_ - head_cache_) >= bytes;
+    }
+
+    void StoreLength(size_t offset, uint32_t length) {
+        std::memcpy(buffer_.data() + offset, &length, sizeof(length));
+    }
+
+    uint32_t LoadLength(size_t offset) const {
+        uint32_t length;
+        std::memcpy(&length, buffer_.data() + offset, sizeof(length));
+        return length;
+    }
+
+    // Runs on the consumer looper.
+    void Drain() {
+        // Cleared first: a commit that lands after this point schedules another turn.
+        drain_.Rearm();
+        auto head = consumed_.load(std::memory_order_relaxed);
+        auto tail = published_.load(std::memory_order_acquire);
+        size_t handled = 0;
+        while (head != tail && handled < kBatch) {
+            auto offset = head & mask_;
+            auto length = LoadLength(offset);
+            if (length == kSkip) {
+                head += capacity_ - offset;
+            } else {
+                on_record_(buffer_.data() + offset + kHeader, length);
+                head += RecordSpan(length);
+                ++handled;
+            }
+            consumed_.store(head, std::memory_order_release);
+            if (head == tail) {
+                tail = published_.load(std::memory_order_acquire);
+            }
+        }
+        if (head != tail) {
+            drain_.Schedule();
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writable_message_ && want_space_.load(std::memory_order_relaxed) &&
+            want_space_.exchange(false, std::memory_order_relaxed)) {
+            writable_message_->SetSendTime(producer_queue_->GetClock()->Now());
+            producer_queue_->Enqueue(writable_message_);
+        }
+    }
+
+  private:
+    ScheduledTask drain_;
+    RecordCallback on_record_;
+    std::shared_ptr<MessageQueue> producer_queue_;
+    MessagePtr writable_message_;
+
+    std::vector<uint8_t> buffer_;
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+
+    // Producer-owned.
+    alignas(64) uint64_t tail_ = 0;
+    uint64_t head_cache_ = 0;
+    size_t reserved_ = 0;
+
+    alignas(64) std::atomic<uint64_t> published_{0};
+    alignas(64) std::atomic<uint64_t> consumed_{0};
+    alignas(64) std::atomic<bool> want_space_{false};
+};
+
+}  // namespace mt
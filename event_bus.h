@@ -0,0 +1,166 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * Typed publish/subscribe. Subscribers register with the Handler their listener should run on;
+ * Publish() wraps the event in one immutable, reference-counted payload that every subscriber
+ * shares, and posts a single message per handler that runs all of that handler's listeners in
+ * subscription order. Handlers are told apart by looper and sub-queue, so a weighted handler keeps
+ * its own sub-queue and weight.
+ *
+ * The subscriber list is copy-on-write: Subscribe() and Unsubscribe() build a new snapshot under a
+ * mutex, while Publish() takes a reference to the current one without locking, so publishers never
+ * wait for each other or for subscription changes. A listener that is unsubscribed is not called
+ * for events delivered afterwards, even if they were published before.
+ */
+template <typename T>
+class EventBus final {
+  public:
+    using Payload = std::shared_ptr<const T>;
+    using Listener = std::function<void(const Payload& event)>;
+    using SubscriptionId = uint64_t;
+
+    EventBus() : current_(new SnapshotPtr(std::make_shared<const Snapshot>())) {}
+    ~EventBus() { delete current_.load(std::memory_order_relaxed); }
+
+    EventBus(const EventBus&) = delete;
+    EventBus& operator=(const EventBus&) = delete;
+
+  public:
+    SubscriptionId Subscribe(const Handler& handler, Listener listener) {
+        auto subscriber = std::make_shared<Subscriber>();
+        subscriber->listener = std::move(listener);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscriber->id = ++last_id_;
+        auto next = std::make_shared<Snapshot>(*Load());
+        auto group = std::find_if(next->begin(), next->end(),
+                                  [&](const Group& g) { return g.handler == handler; });
+        if (group == next->end()) {
+            group = next->insert(next->end(), Group{handler, {}});
+        }
+        group->subscribers.push_back(subscriber);
+        Replace(std::move(next));
+        return subscriber->id;
+    }
+
+    bool Unsubscribe(SubscriptionId id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto next = std::make_shared<Snapshot>(*Load());
+        for (auto group = next->begin(); group != next->end(); ++group) {
+            auto& subscribers = group->subscribers;
+            auto it = std::find_if(subscribers.begin(), subscribers.end(),
+                                   [&](const auto& s) { return s->id == id; });
+            if (it == subscribers.end()) {
+                continue;
+            }
+            (*it)->active.store(false, std::memory_order_release);
+            subscribers.erase(it);
+            if (subscribers.empty()) {
+                next->erase(group);
+            }
+            Replace(std::move(next));
+            return true;
+        }
+        return false;
+    }
+
+    // Returns the number of handlers the event was posted to.
+    size_t Publish(T event) { return Publish(std::make_shared<const T>(std::move(event))); }
+
+    size_t Publish(Payload event) {
+        auto snapshot = Load();
+        size_t posted = 0;
+        for (size_t i = 0; i < snapshot->size(); ++i) {
+            const auto& group = (*snapshot)[i];
+            // Capturing the snapshot keeps this group's subscribers alive until the message runs.
+            posted += group.handler.Post([snapshot, i, event] {
+                for (const auto& subscriber : (*snapshot)[i].subscribers) {
+                    if (subscriber->active.load(std::memory_order_acquire)) {
+                        subscriber->listener(event);
+                    }
+                }
+            });
+        }
+        return posted;
+    }
+
+    [[nodiscard]] size_t SubscriberCount() const {
+        size_t count = 0;
+        for (const auto& group : *Load()) {
+            count += group.subscribers.size();
+        }
+        return count;
+    }
+
+  private:
+    struct Subscriber {
+        SubscriptionId id = 0;
+        Listener listener;
+        std::atomic<bool> active{true};
+    };
+
+    struct Group {
+        Handler handler;
+        std::vector<std::shared_ptr<Subscriber>> subscribers;
+    };
+
+    using Snapshot = std::vector<Group>;
+    using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+    // Takes a reference to the current snapshot. The reader is counted in one of two counters,
+    // chosen by the epoch, for as long as it dereferences `current_`; taking the reference itself
+    // is an atomic increment, so no lock is involved.
+    SnapshotPtr Load() const {
+        auto slot = epoch_.load() & 1;
+        readers_[slot].fetch_add(1);
+        auto snapshot = *current_.load();
+        readers_[slot].fetch_sub(1, std::memory_order_release);
+        return snapshot;
+    }
+
+    // Under mutex_. Swaps in `next`, then frees the old pointer once no reader can still be
+    // dereferencing it: every such reader started before the swap, so it is counted in one of the
+    // two counters. Each epoch flip sends new readers to the other counter, so the one being
+    // waited for drains even while publishers keep coming.
+    void Replace(SnapshotPtr next) {
+        auto* old = current_.exchange(new SnapshotPtr(std::move(next)));
+        for (int flip = 0; flip < 2; ++flip) {
+            auto slot = epoch_.fetch_add(1) & 1;
+            while (readers_[slot].load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+        delete old;
+    }
+
+  private:
+    std::mutex mutex_;
+    SubscriptionId last_id_ = 0;
+    std::atomic<SnapshotPtr*> current_;
+    mutable std::atomic<uint64_t> epoch_{0};
+    mutable std::atomic<int64_t> readers_[2] = {};
+};
+
+}  // namespace mt
@@ -0,0 +1,226 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * Delivers POSIX signals to a Looper through a signalfd: the callback runs on the looper thread
+ * like any other message, with no signal thread and no async-signal-safety restrictions.
+ *
+ * The signals are blocked in the thread that calls Create(). A process-directed signal goes to any
+ * thread that does not block it, so create the watcher (or block the same signals) on the main
+ * thread before other threads are started; threads inherit the mask.
+ */
+class SignalWatcher final : public std::enable_shared_from_this<SignalWatcher> {
+  public:
+    using Callback = std::function<void(const signalfd_siginfo& info)>;
+
+    // Returns nullptr if the signalfd cannot be created or watched.
+    static std::shared_ptr<SignalWatcher> Create(const std::shared_ptr<Looper>& looper,
+                                                 std::initializer_list<int> signals,
+                                                 Callback callback) {
+        auto watcher = std::shared_ptr<SignalWatcher>(
+                new SignalWatcher(looper, signals, std::move(callback)));
+        if (!watcher->Setup()) {
+            return nullptr;
+        }
+        return watcher;
+    }
+
+    // Stops watching. The signals stay blocked, so they remain pending instead of killing the
+    // process with their default action.
+    ~SignalWatcher() {
+        if (fd_ >= 0) {
+            looper_->RemoveFd(fd_);
+            close(fd_);
+        }
+    }
+
+    SignalWatcher(const SignalWatcher&) = delete;
+    SignalWatcher& operator=(const SignalWatcher&) = delete;
+
+  private:
+    SignalWatcher(std::shared_ptr<Looper> looper, std::initializer_list<int> signals,
+                  Callback callback)
+        : looper_(std::move(looper)), callback_(std::move(callback)) {
+        sigemptyset(&mask_);
+        for (auto signal : signals) {
+            sigaddset(&mask_, signal);
+        }
+    }
+
+    bool Setup() {
+        if (pthread_sigmask(SIG_BLOCK, &mask_, nullptr) != 0) {
+            return false;
+        }
+        fd_ = signalfd(-1, &mask_, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd_ < 0) {
+            return false;
+        }
+        return looper_->AddFd(fd_, EPOLLIN, [weak = weak_from_this()](uint32_t) {
+            if (auto watcher = weak.lock()) {
+                watcher->Drain();
+            }
+        });
+    }
+
+    // Several signals may have arrived since the last wakeup; each is reported separately.
+    void Drain() {
+        signalfd_siginfo info{};
+        while (read(fd_, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+            callback_(info);
+        }
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    Callback callback_;
+    sigset_t mask_{};
+    int fd_ = -1;
+};
+
+/**
+ * Reports child-process exits on a Looper through pidfds. Each watched child gets its own pidfd in
+ * the looper's epoll set; when it exits the child is reaped with waitid() and the callback runs on
+ * the looper thread with its exit status. Unlike SIGCHLD, this needs no process-wide handler and
+ * only reaps the children it was asked about.
+ *
+ * Watch() and Unwatch() may be called from any thread. Requires Linux 5.3 or newer.
+ */
+class ChildWatcher final : public std::enable_shared_from_this<ChildWatcher> {
+  public:
+    // `info.si_code` is CLD_EXITED, CLD_KILLED or CLD_DUMPED; `info.si_status` the exit code or
+    // signal number. If the child exited but could not be reaped here (e.g. someone else already
+    // waited for it), the callback still runs once, with a zeroed `info` (si_code == 0).
+    using Callback = std::function<void(pid_t pid, const siginfo_t& info)>;
+
+    static std::shared_ptr<ChildWatcher> Create(const std::shared_ptr<Looper>& looper) {
+        return std::shared_ptr<ChildWatcher>(new ChildWatcher(looper));
+    }
+
+    ~ChildWatcher() {
+        for (const auto& [pidfd, child] : children_) {
+            looper_->RemoveFd(pidfd);
+            close(pidfd);
+        }
+    }
+
+    ChildWatcher(const ChildWatcher&) = delete;
+    ChildWatcher& operator=(const ChildWatcher&) = delete;
+
+  public:
+    // Returns false if `pid` is not a child of this process or pidfds are unsupported. A child
+    // that has already exited is reported on the next loop iteration.
+    bool Watch(pid_t pid, Callback callback) {
+        auto pidfd = static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+        if (pidfd < 0) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            children_[pidfd] = {pid, std::move(callback)};
+        }
+        auto added = looper_->AddFd(pidfd, EPOLLIN, [weak = weak_from_this(), pidfd](uint32_t) {
+            if (auto watcher = weak.lock()) {
+                watcher->Reap(pidfd);
+            }
+        });
+        if (!added) {
+            Forget(pidfd);
+        }
+        return added;
+    }
+
+    // Stops watching `pid` without reaping it.
+    bool Unwatch(pid_t pid) {
+        int pidfd = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& [fd, child] : children_) {
+                if (child.pid == pid) {
+                    pidfd = fd;
+                    break;
+                }
+            }
+        }
+        return pidfd >= 0 && Forget(pidfd);
+    }
+
+  private:
+    struct Child {
+        pid_t pid = 0;
+        Callback callback;
+    };
+
+    // P_PIDFD, which glibc only names from 2.36 on.
+    static constexpr idtype_t kIdPidFd = static_cast<idtype_t>(3);
+
+    explicit ChildWatcher(std::shared_ptr<Looper> looper) : looper_(std::move(looper)) {}
+
+    // Runs once the pidfd is readable, i.e. the process has terminated. Whatever waitid() then
+    // says, the child is forgotten: a readable pidfd stays readable, so keeping it watched would
+    // spin the looper.
+    void Reap(int pidfd) {
+        siginfo_t info{};
+        if (waitid(kIdPidFd, static_cast<id_t>(pidfd), &info, WEXITED | WNOHANG) != 0 ||
+            info.si_pid == 0) {
+            info = siginfo_t{};  // Reaped elsewhere (ECHILD) or not waitable by us.
+        }
+        Child child;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = children_.find(pidfd);
+            if (it == children_.end()) {
+                return;
+            }
+            child = std::move(it->second);
+        }
+        Forget(pidfd);
+        child.callback(child.pid, info);
+    }
+
+    bool Forget(int pidfd) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (children_.erase(pidfd) == 0) {
+                return false;
+            }
+        }
+        looper_->RemoveFd(pidfd);
+        close(pidfd);
+        return true;
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    std::mutex mutex_;
+    std::map<int, Child> children_;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__)
@@ -0,0 +1,307 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+struct HugePageArenaStats {
+    size_t chunks = 0;
+    // Chunks backed by reserved hugetlbfs pages; the others rely on transparent huge pages.
+    size_t hugetlb_chunks = 0;
+    size_t empty_chunks = 0;
+    size_t mapped_bytes = 0;
+    size_t live_bytes = 0;
+    uint64_t released_chunks = 0;
+};
+
+/**
+ * A memory resource that carves messages and queue arrays out of 2MB chunks, each one huge page.
+ * With millions of pending messages, a heap sift in MessageQueue::Next() then touches a few TLB
+ * entries instead of one per message. Pass it to a MessageQueue, Looper or MessageThread.
+ *
+ * Chunks come from MAP_HUGETLB when the system has huge pages reserved and from a 2MB-aligned
+ * mapping with MADV_HUGEPAGE otherwise. Small blocks are bump-allocated and recycled through
+ * free lists kept per chunk and size, under one lock; blocks larger than a quarter chunk, or
+ * aligned to more than 16 bytes, get a mapping of their own. Memory goes back to the OS a whole
+ * chunk at a time, in Trim(), once every block in the chunk is free.
+ */
+class HugePageArena final : public std::pmr::memory_resource {
+  public:
+    static constexpr size_t kChunkSize = size_t(2) << 20;
+
+    HugePageArena() = default;
+
+    ~HugePageArena() override {
+        for (const auto& [base, chunk] : chunks_) {
+            munmap(reinterpret_cast<void*>(base), kChunkSize);
+        }
+        for (const auto& [address, size] : large_) {
+            munmap(reinterpret_cast<void*>(address), size);
+        }
+    }
+
+    HugePageArena(const HugePageArena&) = delete;
+    HugePageArena& operator=(const HugePageArena&) = delete;
+
+  public:
+    // Unmaps every chunk whose blocks have all been freed. Returns the number of chunks released.
+    // Costs one step per chunk and per size class an empty chunk has free blocks of; the free
+    // blocks themselves are never visited.
+    size_t Trim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (empty_chunks_ == 0) {
+            return 0;
+        }
+        size_t released = 0;
+        for (auto it = chunks_.begin(); it != chunks_.end();) {
+            if (it->second.live != 0) {
+                ++it;
+                continue;
+            }
+            for (auto& [size_class, list] : it->second.free_lists) {
+                if (list.head) {
+                    Unlink(size_class, list);
+                }
+            }
+            if (it->first == current_) {
+                current_ = 0;
+                cursor_ = end_ = nullptr;
+            }
+            munmap(reinterpret_cast<void*>(it->first), kChunkSize);
+            hugetlb_chunks_ -= it->second.hugetlb ? 1 : 0;
+            it = chunks_.erase(it);
+            ++released;
+        }
+        empty_chunks_ = 0;
+        released_chunks_ += released;
+        return released;
+    }
+
+    // Calls Trim() from `looper`'s idle handler, at most once per `interval`, so memory is handed
+    // back when the queue drains rather than on the dispatch path. Returns the idle handler id.
+    int TrimWhenIdle(const std::shared_ptr<Looper>& looper,
+                     std::chrono::milliseconds interval = std::chrono::seconds(1)) {
+        auto last_trim = std::make_shared<std::chrono::steady_clock::time_point>();
+        return looper->AddIdleHandler([this, interval, last_trim] {
+            auto now = std::chrono::steady_clock::now();
+            if (now - *last_trim >= interval) {
+                *last_trim = now;
+                Trim();
+            }
+            return true;
+        });
+    }
+
+    HugePageArenaStats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        HugePageArenaStats stats;
+        stats.chunks = chunks_.size();
+        stats.hugetlb_chunks = hugetlb_chunks_;
+        stats.empty_chunks = empty_chunks_;
+        stats.mapped_bytes = chunks_.size() * kChunkSize;
+        for (const auto& [address, size] : large_) {
+            stats.mapped_bytes += size;
+        }
+        stats.live_bytes = live_bytes_;
+        stats.released_chunks = released_chunks_;
+        return stats;
+    }
+
+  private:
+    static constexpr size_t kGranule = 16;
+    static constexpr size_t kMaxSmall = kChunkSize / 4;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // One chunk's free blocks of one size. While it is non-empty, the chunk is listed in
+    // available_[size class] at `index`.
+    struct FreeList {
+        FreeBlock* head = nullptr;
+        size_t index = 0;
+    };
+
+    struct Chunk {
+        size_t live = 0;
+        bool hugetlb = false;
+        // By size class. Entries stay when they run empty, so that recycling a block does not
+        // allocate a map node every time.
+        std::unordered_map<size_t, FreeList> free_lists;
+    };
+
+    static size_t RoundUp(size_t value, size_t to) { return (value + to - 1) / to * to; }
+
+    // Maps `bytes` (a multiple of kChunkSize) aligned to kChunkSize.
+    static void* MapHuge(size_t bytes, bool* hugetlb) {
+        auto* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            *hugetlb = true;
+            return memory;
+        }
+        *hugetlb = false;
+        // Over-map by a chunk and trim both ends to get the alignment THP needs.
+        auto* raw = mmap(nullptr, bytes + kChunkSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            return nullptr;
+        }
+        auto begin = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = RoundUp(begin, kChunkSize);
+        if (aligned > begin) {
+            munmap(raw, aligned - begin);
+        }
+        auto tail = begin + bytes + kChunkSize - (aligned + bytes);
+        if (tail > 0) {
+            munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+        }
+        madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    Chunk* FindChunk(const void* block) {
+        auto base = reinterpret_cast<uintptr_t>(block) & ~(kChunkSize - 1);
+        return &chunks_.at(base);
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        auto size = RoundUp(std::max(bytes, alignment), kGranule);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size > kMaxSmall || alignment > kGranule) {
+            return AllocateLarge(size);
+        }
+        live_bytes_ += size;
+        auto size_class = size / kGranule;
+        auto available = available_.find(size_class);
+        if (available != available_.end() && !available->second.empty()) {
+            auto* chunk = available->second.back();
+            auto& list = chunk->free_lists[size_class];
+            auto* block = list.head;
+            list.head = block->next;
+            if (!list.head) {
+                available->second.pop_back();
+            }
+            Acquire(chunk);
+            return block;
+        }
+        if (cursor_ + size > end_) {
+            bool hugetlb;
+            auto* memory = static_cast<char*>(MapHuge(kChunkSize, &hugetlb));
+            if (!memory) {
+                live_bytes_ -= size;
+                throw std::bad_alloc();
+            }
+            current_ = reinterpret_cast<uintptr_t>(memory);
+            chunks_[current_].hugetlb = hugetlb;
+            hugetlb_chunks_ += hugetlb ? 1 : 0;
+            // A fresh chunk counts as empty until its first block is handed out.
+            ++empty_chunks_;
+            cursor_ = memory;
+            end_ = memory + kChunkSize;
+        }
+        auto* block = cursor_;
+        cursor_ += size;
+        Acquire(&chunks_[current_]);
+        return block;
+    }
+
+    void do_deallocate(void* block, size_t bytes, size_t alignment) override {
+        auto size = RoundUp(std::max(bytes, alignment), kGranule);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size > kMaxSmall || alignment > kGranule) {
+            auto it = large_.find(reinterpret_cast<uintptr_t>(block));
+            munmap(block, it->second);
+            large_.erase(it);
+            return;
+        }
+        live_bytes_ -= size;
+        auto size_class = size / kGranule;
+        auto* chunk = FindChunk(block);
+        auto& list = chunk->free_lists[size_class];
+        if (!list.head) {
+            auto& chunks = available_[size_class];
+            list.index = chunks.size();
+            chunks.push_back(chunk);
+        }
+        list.head = new (block) FreeBlock{list.head};
+        if (--chunk->live == 0) {
+            ++empty_chunks_;
+        }
+    }
+
+    [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    void* AllocateLarge(size_t size) {
+        auto mapped = RoundUp(size, kChunkSize);
+        bool hugetlb;
+        auto* memory = MapHuge(mapped, &hugetlb);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        large_[reinterpret_cast<uintptr_t>(memory)] = mapped;
+        return memory;
+    }
+
+    // Takes a chunk that is about to be unmapped out of available_[size_class].
+    void Unlink(size_t size_class, FreeList& list) {
+        auto& chunks = available_[size_class];
+        auto* moved = chunks.back();
+        chunks[list.index] = moved;
+        moved->free_lists[size_class].index = list.index;
+        chunks.pop_back();
+        list.head = nullptr;
+    }
+
+    void Acquire(Chunk* chunk) {
+        if (chunk->live++ == 0) {
+            --empty_chunks_;
+        }
+    }
+
+  private:
+    std::mutex mutex_;
+    std::unordered_map<uintptr_t, Chunk> chunks_;
+    // By size class, the chunks that have free blocks of that size; allocation takes from the
+    // last one listed.
+    std::unordered_map<size_t, std::vector<Chunk*>> available_;
+    // Blocks too large for a chunk, by address, with their mapped size.
+    std::unordered_map<uintptr_t, size_t> large_;
+    uintptr_t current_ = 0;
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+    size_t hugetlb_chunks_ = 0;
+    size_t empty_chunks_ = 0;
+    size_t live_bytes_ = 0;
+    uint64_t released_chunks_ = 0;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__)
@@ -0,0 +1,287 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * An io_uring instance owned by a Looper. Reads, writes, accepts and fsyncs are submitted from the
+ * looper thread and their completions run as messages on that same looper, so callbacks never
+ * block on I/O. The ring's completion queue is one of the looper's watched descriptors: the looper
+ * sleeps on its messages and on I/O completions in a single epoll_wait.
+ *
+ * Submissions are batched: queued entries are handed to the kernel by a single io_uring_enter from
+ * a flush message that runs after the callbacks queued behind it, i.e. once per loop iteration.
+ *
+ * Talks to the kernel through the raw system calls, so no liburing is needed. All methods must be
+ * called on the looper thread.
+ */
+class IoRing final : public std::enable_shared_from_this<IoRing> {
+  public:
+    // Receives the operation's result: a byte count or new fd on success, -errno on failure.
+    using Completion = std::function<void(int result)>;
+
+    // Returns nullptr when io_uring is unavailable (old kernel, seccomp, ...).
+    static std::shared_ptr<IoRing> Create(const std::shared_ptr<Looper>& looper,
+                                          unsigned entries = 256) {
+        auto ring = std::shared_ptr<IoRing>(new IoRing(looper));
+        if (!ring->Setup(entries)) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    ~IoRing() {
+        if (ring_fd_ < 0) {
+            return;
+        }
+        looper_->RemoveFd(ring_fd_);
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+        close(ring_fd_);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+  public:
+    bool Read(int fd, void* buffer, uint32_t length, uint64_t offset, Completion completion) {
+        auto* sqe = Prepare(IORING_OP_READ, fd, std::move(completion));
+        if (!sqe) return false;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = length;
+        sqe->off = offset;
+        return Commit();
+    }
+
+    bool Write(int fd, const void* buffer, uint32_t length, uint64_t offset,
+               Completion completion) {
+        auto* sqe = Prepare(IORING_OP_WRITE, fd, std::move(completion));
+        if (!sqe) return false;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = length;
+        sqe->off = offset;
+        return Commit();
+    }
+
+    bool Accept(int fd, sockaddr* address, socklen_t* address_length, Completion completion) {
+        auto* sqe = Prepare(IORING_OP_ACCEPT, fd, std::move(completion));
+        if (!sqe) return false;
+        sqe->addr = reinterpret_cast<uint64_t>(address);
+        sqe->addr2 = reinterpret_cast<uint64_t>(address_length);
+        return Commit();
+    }
+
+    bool Fsync(int fd, Completion completion, bool data_only = false) {
+        auto* sqe = Prepare(IORING_OP_FSYNC, fd, std::move(completion));
+        if (!sqe) return false;
+        sqe->fsync_flags = data_only ? IORING_FSYNC_DATASYNC : 0;
+        return Commit();
+    }
+
+    // Hands every queued entry to the kernel now instead of at the end of the loop iteration.
+    bool Submit() {
+        while (unsubmitted_ > 0) {
+            auto submitted = Enter(unsubmitted_, 0, 0);
+            if (submitted < 0 && errno == EINTR) {
+                continue;
+            }
+            if (submitted <= 0) {
+                return false;  // EAGAIN/EBUSY: retried by the next flush.
+            }
+            unsubmitted_ -= static_cast<unsigned>(submitted);
+        }
+        return true;
+    }
+
+    [[nodiscard]] size_t InFlight() const { return in_flight_; }
+
+  private:
+    explicit IoRing(std::shared_ptr<Looper> looper) : looper_(std::move(looper)) {}
+
+    template <typename T>
+    static T* At(void* base, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                                        flags, nullptr, 0));
+    }
+
+    bool Setup(unsigned entries) {
+        io_uring_params params{};
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd_ < 0) {
+            return false;
+        }
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap ? sq_ring_ : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+        if (!sq_ring_ || !cq_ring_ || !sqes_) {
+            return false;
+        }
+
+        sq_head_ = At<unsigned>(sq_ring_, params.sq_off.head);
+        sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+        sq_mask_ = *At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+        sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+        cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+        cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+        cq_mask_ = *At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+        cqes_ = At<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+        cq_entries_ = params.cq_entries;
+
+        std::weak_ptr<IoRing> weak = weak_from_this();
+        flush_message_ = std::make_shared<Message>();
+        flush_message_->SetAsynchronous(true);
+        flush_message_->SetCallback([weak] {
+            if (auto ring = weak.lock()) {
+                ring->flush_scheduled_ = false;
+                ring->Submit();
+            }
+        });
+        return looper_->AddFd(ring_fd_, EPOLLIN, [weak](uint32_t) {
+            if (auto ring = weak.lock()) {
+                ring->Reap();
+            }
+        });
+    }
+
+    void* Map(size_t size, off_t offset) {
+        void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring_fd_, offset);
+        return address == MAP_FAILED ? nullptr : address;
+    }
+
+    // Reserves a submission entry and a completion slot; nullptr when the ring is full.
+    io_uring_sqe* Prepare(uint8_t opcode, int fd, Completion&& completion) {
+        // Keeping in-flight operations within the completion queue means it can never overflow.
+        if (in_flight_ >= cq_entries_) {
+            return nullptr;
+        }
+        auto tail = *sq_tail_;
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            Submit();
+            if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+                return nullptr;
+            }
+        }
+        uint64_t slot;
+        if (free_slots_.empty()) {
+            slot = completions_.size();
+            completions_.push_back(std::move(completion));
+        } else {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+            completions_[slot] = std::move(completion);
+        }
+        auto index = tail & sq_mask_;
+        auto* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = slot;
+        sq_array_[index] = index;
+        return sqe;
+    }
+
+    bool Commit() {
+        __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+        ++unsubmitted_;
+        ++in_flight_;
+        if (!flush_scheduled_) {
+            flush_scheduled_ = true;
+            auto queue = looper_->GetMessageQueue();
+            flush_message_->SetSendTime(queue->GetClock()->Now());
+            if (!queue->Enqueue(flush_message_)) {
+                flush_scheduled_ = false;  // Quitting: nothing will run the flush.
+                return Submit();
+            }
+        }
+        return true;
+    }
+
+    // Runs the completion callbacks for everything the kernel has finished.
+    void Reap() {
+        auto head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const auto& cqe = cqes_[head & cq_mask_];
+            auto slot = cqe.user_data;
+            auto result = cqe.res;
+            // Released before the callback so that it can submit again without running out.
+            __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+            auto completion = std::move(completions_[slot]);
+            completions_[slot] = nullptr;
+            free_slots_.push_back(slot);
+            --in_flight_;
+            if (completion) {
+                completion(result);
+            }
+        }
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    int ring_fd_ = -1;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+    unsigned cq_entries_ = 0;
+
+    unsigned unsubmitted_ = 0;
+    size_t in_flight_ = 0;
+    bool flush_scheduled_ = false;
+    MessagePtr flush_message_;
+    std::vector<Completion> completions_;
+    std::vector<uint64_t> free_slots_;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__) && __has_include(<linux/io_uring.h>)
@@ -0,0 +1,241 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+// How a producer waits for the slowest consumer when the ring is full.
+enum class WaitStrategy {
+    kBusySpin,  // Lowest latency; burns the producer's core.
+    kYield,     // Spins with sched_yield() in between.
+    kBlock,     // Sleeps on a condition variable until a consumer frees a slot.
+};
+
+/**
+ * A single-producer multicast ring in the style of the LMAX disruptor. The producer writes each
+ * event once, in place, into a preallocated slot; every consumer reads it from the same slot on
+ * its own Looper, tracking its progress with its own cursor. A consumer may depend on others and
+ * then only sees an event once all of them are done with it, which pipelines work over one copy.
+ *
+ * Consumers do not poll: like any other looper work they are scheduled through a reused message,
+ * enqueued only when the consumer is not already pending, and they read everything available in
+ * one turn (with `end_of_batch` set on the last event) before yielding the looper.
+ *
+ * Consumers must be added before the first event is published. Publish() must be called from one
+ * thread at a time, which must not be a consumer's looper when using a blocking wait.
+ */
+template <typename T>
+class MulticastRing final {
+  public:
+    using ConsumerId = size_t;
+    using EventCallback = std::function<void(const T& event, int64_t sequence, bool end_of_batch)>;
+
+    // `capacity` is rounded up to a power of two.
+    static std::shared_ptr<MulticastRing> Create(size_t capacity,
+                                                 WaitStrategy wait = WaitStrategy::kBlock) {
+        auto ring = std::shared_ptr<MulticastRing>(new MulticastRing(capacity, wait));
+        // Consumer messages hold the ring weakly, so that pending ones do not keep it alive.
+        ring->self_ = ring;
+        return ring;
+    }
+
+    ~MulticastRing() = default;
+
+    MulticastRing(const MulticastRing&) = delete;
+    MulticastRing& operator=(const MulticastRing&) = delete;
+
+  public:
+    // Registers a consumer that runs `callback` for every event on `looper`, after every consumer
+    // in `depends_on` has processed it.
+    ConsumerId AddConsumer(const std::shared_ptr<Looper>& looper, EventCallback callback,
+                           const std::vector<ConsumerId>& depends_on = {}) {
+        auto id = consumers_.size();
+        auto consumer = std::make_unique<Consumer>(looper->GetMessageQueue());
+        consumer->callback = std::move(callback);
+        consumer->task.SetCallback([weak = self_, id] {
+            if (auto ring = weak.lock()) {
+                ring->Drain(*ring->consumers_[id]);
+            }
+        });
+        for (auto dependency : depends_on) {
+            consumer->dependencies.push_back(consumers_[dependency].get());
+            consumers_[dependency]->dependents.push_back(consumer.get());
+        }
+        consumers_.push_back(std::move(consumer));
+        return id;
+    }
+
+    // Claims the next slot, lets `fill(T&)` write the event in place and publishes it, waiting
+    // according to the ring's strategy while the slowest consumer is a full ring behind.
+    template <typename F>
+    int64_t Publish(F&& fill) {
+        auto sequence = published_.load(std::memory_order_relaxed) + 1;
+        WaitForSlot(sequence);
+        fill(slots_[static_cast<size_t>(sequence) & mask_]);
+        Commit(sequence);
+        return sequence;
+    }
+
+    // Like Publish(), but returns -1 instead of waiting when the ring is full.
+    template <typename F>
+    int64_t TryPublish(F&& fill) {
+        auto sequence = published_.load(std::memory_order_relaxed) + 1;
+        if (!HasSlot(sequence)) {
+            return -1;
+        }
+        fill(slots_[static_cast<size_t>(sequence) & mask_]);
+        Commit(sequence);
+        return sequence;
+    }
+
+    // Last sequence processed by `consumer`, -1 before the first event.
+    [[nodiscard]] int64_t GetCursor(ConsumerId consumer) const {
+        return consumers_[consumer]->cursor.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] int64_t GetPublished() const {
+        return published_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] size_t Capacity() const { return slots_.size(); }
+
+  private:
+    struct Consumer {
+        explicit Consumer(std::shared_ptr<MessageQueue> queue) : task(std::move(queue)) {}
+
+        alignas(64) std::atomic<int64_t> cursor{-1};
+        ScheduledTask task;
+        EventCallback callback;
+        std::vector<Consumer*> dependencies;
+        std::vector<Consumer*> dependents;
+    };
+
+    // Events handed to one consumer per looper turn.
+    static constexpr int64_t kBatch = 1024;
+
+    MulticastRing(size_t capacity, WaitStrategy wait) : wait_(wait) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    bool HasSlot(int64_t sequence) {
+        auto wrap = sequence - static_cast<int64_t>(slots_.size());
+        if (gate_cache_ >= wrap) {
+            return true;
+        }
+        gate_cache_ = MinimumCursor();
+        return gate_cache_ >= wrap;
+    }
+
+    int64_t MinimumCursor() const {
+        auto minimum = published_.load(std::memory_order_relaxed);
+        for (const auto& consumer : consumers_) {
+            minimum = std::min(minimum, consumer->cursor.load(std::memory_order_acquire));
+        }
+        return minimum;
+    }
+
+    void WaitForSlot(int64_t sequence) {
+        while (!HasSlot(sequence)) {
+            switch (wait_) {
+                case WaitStrategy::kBusySpin:
+                    break;
+                case WaitStrategy::kYield:
+                    std::this_thread::yield();
+                    break;
+                case WaitStrategy::kBlock: {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    producer_waiting_.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    cv_.wait(lock, [&] { return HasSlot(sequence); });
+                    producer_waiting_.store(false, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+    }
+
+    void Commit(int64_t sequence) {
+        published_.store(sequence, std::memory_order_release);
+        for (const auto& consumer : consumers_) {
+            if (consumer->dependencies.empty()) {
+                consumer->task.Schedule();
+            }
+        }
+    }
+
+    int64_t Available(const Consumer& consumer) const {
+        auto available = published_.load(std::memory_order_acquire);
+        for (const auto* dependency : consumer.dependencies) {
+            available = std::min(available, dependency->cursor.load(std::memory_order_acquire));
+        }
+        return available;
+    }
+
+    // Runs on the consumer's looper.
+    void Drain(Consumer& consumer) {
+        consumer.task.Rearm();
+        auto cursor = consumer.cursor.load(std::memory_order_relaxed);
+        auto available = std::min(Available(consumer), cursor + kBatch);
+        if (available <= cursor) {
+            return;
+        }
+        for (auto sequence = cursor + 1; sequence <= available; ++sequence) {
+            consumer.callback(slots_[static_cast<size_t>(sequence) & mask_], sequence,
+                              sequence == available);
+        }
+        consumer.cursor.store(available, std::memory_order_release);
+        // Paired with the fence in WaitForSlot(): a blocked producer either sees the new cursor or
+        // is notified.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (auto* dependent : consumer.dependents) {
+            dependent->task.Schedule();
+        }
+        if (Available(consumer) > available) {
+            consumer.task.Schedule();  // More arrived, or the batch was capped.
+        }
+        if (producer_waiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+  private:
+    std::weak_ptr<MulticastRing> self_;
+    WaitStrategy wait_;
+    std::vector<T> slots_;
+    size_t mask_ = 0;
+    std::vector<std::unique_ptr<Consumer>> consumers_;
+
+    // Producer-owned.
+    alignas(64) int64_t gate_cache_ = -1;
+    alignas(64) std::atomic<int64_t> published_{-1};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> producer_waiting_{false};
+};
+
+}  // namespace mt
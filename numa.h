@@ -0,0 +1,291 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * The CPUs of each NUMA node, read from sysfs. Simulate() splits the CPUs the process may run on
+ * into groups instead, for trying node-aware placement on a single-node machine.
+ */
+class NumaTopology final {
+  public:
+    // Node ids may be sparse, so the nodes are taken from the kernel's online list; memory-only
+    // nodes have no CPUs to run loopers on and are left out. Falls back to a single node holding
+    // every allowed CPU when sysfs has no node information.
+    static NumaTopology Detect() {
+        NumaTopology topology;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string ids;
+        std::getline(online, ids);
+        for (int id : ParseCpuList(ids)) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            auto cpus = ParseCpuList(list);
+            if (!cpus.empty()) {
+                topology.ids_.push_back(id);
+                topology.cpus_.push_back(std::move(cpus));
+            }
+        }
+        if (topology.cpus_.empty()) {
+            topology.ids_.push_back(0);
+            topology.cpus_.push_back(AllowedCpus());
+        }
+        return topology;
+    }
+
+    static NumaTopology Simulate(size_t nodes) {
+        auto cpus = AllowedCpus();
+        NumaTopology topology;
+        topology.simulated_ = true;
+        topology.cpus_.resize(std::max<size_t>(nodes, 1));
+        for (size_t node = 0; node < topology.cpus_.size(); ++node) {
+            topology.ids_.push_back(static_cast<int>(node));
+        }
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            topology.cpus_[i * topology.cpus_.size() / cpus.size()].push_back(cpus[i]);
+        }
+        // With fewer CPUs than nodes, the empty nodes share the last CPU.
+        for (auto& node_cpus : topology.cpus_) {
+            if (node_cpus.empty() && !cpus.empty()) node_cpus.push_back(cpus.back());
+        }
+        return topology;
+    }
+
+    [[nodiscard]] size_t NodeCount() const { return cpus_.size(); }
+
+    [[nodiscard]] const std::vector<int>& Cpus(size_t node) const { return cpus_[node]; }
+
+    // The kernel's id for the node at index `node`, as used by mbind(); indices are dense, ids
+    // need not be.
+    [[nodiscard]] int NodeId(size_t node) const { return ids_[node]; }
+
+    // Simulated nodes share physical memory, so their memory is not bound to a node.
+    [[nodiscard]] bool IsSimulated() const { return simulated_; }
+
+    // The node `cpu` belongs to, or 0 if it is not in any.
+    [[nodiscard]] size_t NodeOfCpu(int cpu) const {
+        for (size_t node = 0; node < cpus_.size(); ++node) {
+            if (std::find(cpus_[node].begin(), cpus_[node].end(), cpu) != cpus_[node].end()) {
+                return node;
+            }
+        }
+        return 0;
+    }
+
+    // The node of the CPU the calling thread is running on right now.
+    [[nodiscard]] size_t CurrentNode() const { return NodeOfCpu(sched_getcpu()); }
+
+    // Parses the kernel's "0-3,8,10-11" list format, used for both CPU and node lists.
+    static std::vector<int> ParseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        size_t position = 0;
+        while (position < list.size()) {
+            auto end = list.find(',', position);
+            if (end == std::string::npos) end = list.size();
+            auto range = list.substr(position, end - position);
+            int first = 0;
+            int last = 0;
+            auto fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (fields == 1) last = first;
+            for (int cpu = first; fields >= 1 && cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+            position = end + 1;
+        }
+        return cpus;
+    }
+
+  private:
+    static std::vector<int> AllowedCpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty()) {
+            cpus.push_back(0);
+        }
+        return cpus;
+    }
+
+  private:
+    std::vector<int> ids_;
+    std::vector<std::vector<int>> cpus_;
+    bool simulated_ = false;
+};
+
+/**
+ * Pooled memory whose pages are placed on one NUMA node. Chunks are mapped with mmap and bound to
+ * the node with mbind(MPOL_PREFERRED), so they stay local no matter which thread touches them
+ * first; small blocks are then carved out of them by a synchronized pool, which lets a message be
+ * allocated by its producer and freed by the looper that ran it.
+ */
+class NodeMemoryResource final : public std::pmr::memory_resource {
+  public:
+    // `node` < 0 maps the chunks without binding them.
+    explicit NodeMemoryResource(int node) : chunks_(node), pool_(&chunks_) {}
+    ~NodeMemoryResource() override = default;
+
+  private:
+    class ChunkResource final : public std::pmr::memory_resource {
+      public:
+        explicit ChunkResource(int node) : node_(node) {}
+
+      private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            auto* chunk = mmap(nullptr, RoundUp(bytes), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (chunk == MAP_FAILED || alignment > PageSize()) {
+                if (chunk != MAP_FAILED) munmap(chunk, RoundUp(bytes));
+                throw std::bad_alloc();
+            }
+            if (node_ >= 0 && node_ < kMaxNodes) {
+                // Best effort: without a NUMA kernel the pages just land wherever they are touched.
+                unsigned long mask = 1UL << node_;
+                syscall(SYS_mbind, chunk, RoundUp(bytes), kMpolPreferred, &mask, kMaxNodes + 1, 0);
+            }
+            return chunk;
+        }
+
+        void do_deallocate(void* chunk, size_t bytes, size_t) override {
+            munmap(chunk, RoundUp(bytes));
+        }
+
+        [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        static size_t PageSize() {
+            static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            return page_size;
+        }
+
+        static size_t RoundUp(size_t bytes) {
+            return (bytes + PageSize() - 1) / PageSize() * PageSize();
+        }
+
+        // From <numaif.h>, which needs libnuma's headers.
+        static constexpr int kMpolPreferred = 1;
+        static constexpr int kMaxNodes = 64;
+
+        int node_;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        return pool_.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* block, size_t bytes, size_t alignment) override {
+        pool_.deallocate(block, bytes, alignment);
+    }
+
+    [[nodiscard]] bool do_is_equal(const memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+  private:
+    ChunkResource chunks_;
+    std::pmr::synchronized_pool_resource pool_;
+};
+
+/**
+ * Loopers grouped by NUMA node. Each node gets a MessageThreadPool whose threads are pinned to the
+ * node's CPUs and whose messages and queue heaps live in node-local memory, so a message posted
+ * from the same node is written, queued and run without touching the other socket.
+ *
+ * Routing helpers pick a looper on the caller's node. Messages posted from another node still
+ * work; they just pay for remote memory on the producer side.
+ */
+class NumaLooperPool final {
+  public:
+    explicit NumaLooperPool(size_t threads_per_node, NumaTopology topology = NumaTopology::Detect())
+        : topology_(std::move(topology)) {
+        for (size_t node = 0; node < topology_.NodeCount(); ++node) {
+            ThreadOptions options;
+            options.name = "numa" + std::to_string(topology_.NodeId(node));
+            options.cpus = topology_.Cpus(node);
+            auto resource = std::make_shared<NodeMemoryResource>(
+                    topology_.IsSimulated() ? -1 : topology_.NodeId(node));
+            nodes_.push_back(std::make_unique<MessageThreadPool>(threads_per_node, options,
+                                                                 std::move(resource)));
+        }
+    }
+
+    ~NumaLooperPool() = default;
+
+  public:
+    [[nodiscard]] const NumaTopology& GetTopology() const { return topology_; }
+
+    [[nodiscard]] size_t NodeCount() const { return nodes_.size(); }
+
+    // The node's loopers, e.g. for ParallelFor over one node.
+    [[nodiscard]] MessageThreadPool& GetNodePool(size_t node) { return *nodes_[node]; }
+
+    [[nodiscard]] std::shared_ptr<Looper> GetLooper(size_t node, size_t index) const {
+        return nodes_[node]->GetLooper(index);
+    }
+
+    // A looper on `node`, taken round-robin.
+    [[nodiscard]] std::shared_ptr<Looper> NodeLooper(size_t node) {
+        return nodes_[node]->NextLooper();
+    }
+
+    // A looper on the calling thread's node.
+    [[nodiscard]] std::shared_ptr<Looper> LocalLooper() {
+        return NodeLooper(topology_.CurrentNode());
+    }
+
+    // The node `looper` runs on, or -1 if it is not one of the pool's.
+    [[nodiscard]] int NodeOf(const std::shared_ptr<Looper>& looper) const {
+        for (size_t node = 0; node < nodes_.size(); ++node) {
+            for (size_t i = 0; i < nodes_[node]->Size(); ++i) {
+                if (nodes_[node]->GetLooper(i) == looper) {
+                    return static_cast<int>(node);
+                }
+            }
+        }
+        return -1;
+    }
+
+    void Braking() {
+        for (auto& pool : nodes_) {
+            pool->Braking();
+        }
+    }
+
+  private:
+    NumaTopology topology_;
+    std::vector<std::unique_ptr<MessageThreadPool>> nodes_;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__)
@@ -0,0 +1,175 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "thread.h"
+
+namespace mt {
+
+namespace parallel_internal {
+
+/**
+ * Work shared by the caller and the pool's helpers. Chunks are claimed from an atomic cursor with
+ * guided self-scheduling: each claim takes a share of what is left (never less than the grain), so
+ * chunks start large and shrink towards the end, where they balance the stragglers.
+ *
+ * Heap allocated and shared with the helper messages: a helper that only starts after all the work
+ * is done finds nothing to claim, but may still do so after the caller has returned. The caller's
+ * callables are only touched after a successful claim, i.e. while the caller is still waiting.
+ */
+struct Work {
+    Work(size_t begin, size_t end, size_t grain, size_t participants)
+        : next(begin),
+          end(end),
+          grain(std::max<size_t>(grain, 1)),
+          participants(participants),
+          remaining(end - begin) {}
+
+    // Claims [*chunk_begin, *chunk_end); false once the range is exhausted.
+    bool Claim(size_t* chunk_begin, size_t* chunk_end) {
+        auto current = next.load(std::memory_order_relaxed);
+        while (current < end) {
+            auto size = std::max(grain, (end - current) / (2 * participants));
+            auto claimed_end = std::min(end, current + size);
+            if (next.compare_exchange_weak(current, claimed_end, std::memory_order_relaxed)) {
+                *chunk_begin = current;
+                *chunk_end = claimed_end;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Complete(size_t items) {
+        if (remaining.fetch_sub(items, std::memory_order_acq_rel) == items) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cv.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return remaining.load(std::memory_order_acquire) == 0; });
+    }
+
+    alignas(64) std::atomic<size_t> next;
+    size_t end;
+    size_t grain;
+    size_t participants;
+    alignas(64) std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// Posts one helper per pool looper; each keeps claiming chunks until the range is exhausted.
+template <typename W, typename Run>
+void StartHelpers(MessageThreadPool& pool, const std::shared_ptr<W>& work, Run run) {
+    for (size_t i = 0; i < pool.Size(); ++i) {
+        Handler(pool.GetLooper(i)).Post([work, run] { run(*work); });
+    }
+}
+
+}  // namespace parallel_internal
+
+/**
+ * Runs `body(chunk_begin, chunk_end)` over [begin, end) on the pool's loopers and the calling
+ * thread, and returns once every index has been processed. The caller works through chunks
+ * alongside the helpers rather than blocking while they run, so calling it from a looper (even one
+ * of the pool's own) is fine. `body` runs concurrently and must be safe to call from several
+ * threads.
+ *
+ * Costs one message per pool looper and one shared work descriptor per call, none per chunk.
+ */
+template <typename Body>
+void ParallelFor(MessageThreadPool& pool, size_t begin, size_t end, size_t grain,
+                 const Body& body) {
+    if (begin >= end) {
+        return;
+    }
+    using parallel_internal::Work;
+    if (end - begin <= grain) {
+        body(begin, end);
+        return;
+    }
+    auto work = std::make_shared<Work>(begin, end, grain, pool.Size() + 1);
+    auto run = [&body](Work& w) {
+        size_t chunk_begin, chunk_end;
+        while (w.Claim(&chunk_begin, &chunk_end)) {
+            body(chunk_begin, chunk_end);
+            w.Complete(chunk_end - chunk_begin);
+        }
+    };
+    parallel_internal::StartHelpers(pool, work, run);
+    run(*work);
+    work->Wait();
+}
+
+/**
+ * Folds [begin, end) in parallel. Each participant accumulates its chunks locally with
+ * `body(chunk_begin, chunk_end, T accumulator) -> T`, starting from `identity`, and the partial
+ * results are combined with `reduce(T, T) -> T`. The order in which chunks and partials are
+ * combined is unspecified, so `reduce` must be associative and commutative.
+ */
+template <typename T, typename Body, typename Reduce>
+T ParallelReduce(MessageThreadPool& pool, size_t begin, size_t end, size_t grain, T identity,
+                 const Body& body, const Reduce& reduce) {
+    if (begin >= end) {
+        return identity;
+    }
+    if (end - begin <= grain) {
+        return body(begin, end, std::move(identity));
+    }
+    struct ReduceWork : parallel_internal::Work {
+        ReduceWork(size_t begin, size_t end, size_t grain, size_t participants, T identity)
+            : Work(begin, end, grain, participants), identity(std::move(identity)) {}
+
+        T identity;
+        std::mutex result_mutex;
+        std::optional<T> result;
+    };
+
+    auto work = std::make_shared<ReduceWork>(begin, end, grain, pool.Size() + 1,
+                                             std::move(identity));
+    auto run = [&body, &reduce](ReduceWork& w) {
+        size_t chunk_begin, chunk_end;
+        if (!w.Claim(&chunk_begin, &chunk_end)) {
+            return;
+        }
+        T accumulator = w.identity;
+        size_t items = 0;
+        do {
+            accumulator = body(chunk_begin, chunk_end, std::move(accumulator));
+            items += chunk_end - chunk_begin;
+        } while (w.Claim(&chunk_begin, &chunk_end));
+        {
+            std::lock_guard<std::mutex> lock(w.result_mutex);
+            w.result = w.result ? reduce(std::move(*w.result), std::move(accumulator))
+                                : std::move(accumulator);
+        }
+        // Only counted once the partial is folded in, so the caller sees every partial.
+        w.Complete(items);
+    };
+    parallel_internal::StartHelpers(pool, work, run);
+    run(*work);
+    work->Wait();
+    std::lock_guard<std::mutex> lock(work->result_mutex);
+    return std::move(*work->result);
+}
+
+}  // namespace mt
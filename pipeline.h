@@ -0,0 +1,383 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "thread.h"
+
+namespace mt {
+
+struct StageOptions {
+    // Loopers running the stage; more than one makes it a parallel stage.
+    size_t workers = 1;
+    // Items admitted to the stage (queued, running or waiting to be handed on) at any time.
+    size_t capacity = 1024;
+    // Whether a parallel stage hands its results on in arrival order.
+    bool ordered = true;
+};
+
+struct StageStats {
+    std::string name;
+    size_t workers = 0;
+    size_t capacity = 0;
+    size_t occupancy = 0;
+    size_t max_occupancy = 0;
+    uint64_t processed = 0;
+    // Time spent by upstream waiting for the stage to admit an item: backpressure exerted.
+    uint64_t blocked_ns = 0;
+    // Fraction of the workers' time spent in the stage function since the pipeline started.
+    double utilization = 0;
+    double items_per_sec = 0;
+};
+
+namespace pipeline_internal {
+
+/**
+ * Admission control and accounting shared by all stages. A stage admits at most `capacity` items
+ * and releases each one only once its result has been accepted downstream, so a full stage blocks
+ * the stage before it, which in turn fills up and blocks its own upstream.
+ */
+class StageBase {
+  public:
+    StageBase(std::string name, const StageOptions& options)
+        : name_(std::move(name)),
+          options_(options),
+          pool_(options.workers),
+          start_(std::chrono::steady_clock::now()) {
+        options_.workers = pool_.Size();
+        options_.capacity = std::max<size_t>(options_.capacity, 1);
+        for (size_t i = 0; i < pool_.Size(); ++i) {
+            handlers_.emplace_back(pool_.GetLooper(i));
+        }
+    }
+
+    virtual ~StageBase() = default;
+
+    StageBase(const StageBase&) = delete;
+    StageBase& operator=(const StageBase&) = delete;
+
+  public:
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return occupancy_ == 0; });
+    }
+
+    void Stop() { pool_.Braking(); }
+
+    StageStats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StageStats stats;
+        stats.name = name_;
+        stats.workers = options_.workers;
+        stats.capacity = options_.capacity;
+        stats.occupancy = occupancy_;
+        stats.max_occupancy = max_occupancy_;
+        stats.processed = processed_;
+        stats.blocked_ns = blocked_ns_;
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_);
+        auto busy = static_cast<double>(busy_ns_.load(std::memory_order_relaxed)) / 1e9;
+        stats.utilization = busy / (elapsed.count() * static_cast<double>(options_.workers));
+        stats.items_per_sec = static_cast<double>(processed_) / elapsed.count();
+        return stats;
+    }
+
+  protected:
+    // Blocks until the stage has room and returns the item's arrival sequence number.
+    uint64_t Admit() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (occupancy_ >= options_.capacity) {
+            auto waited_from = std::chrono::steady_clock::now();
+            cv_.wait(lock, [this] { return occupancy_ < options_.capacity; });
+            blocked_ns_ += static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - waited_from)
+                            .count());
+        }
+        max_occupancy_ = std::max(max_occupancy_, ++occupancy_);
+        return next_sequence_++;
+    }
+
+    void Release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --occupancy_;
+        ++processed_;
+        cv_.notify_all();
+    }
+
+    template <typename F>
+    void Dispatch(uint64_t sequence, F&& f) {
+        handlers_[sequence % handlers_.size()].Post(std::forward<F>(f));
+    }
+
+    template <typename F>
+    auto Timed(F&& f) {
+        struct Timer {
+            StageBase* stage;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ~Timer() {
+                stage->busy_ns_.fetch_add(
+                        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                      std::chrono::steady_clock::now() - start)
+                                                      .count()),
+                        std::memory_order_relaxed);
+            }
+        } timer{this};
+        return f();
+    }
+
+    [[nodiscard]] bool Ordered() const { return options_.ordered && options_.workers > 1; }
+
+  protected:
+    std::mutex mutex_;
+
+  private:
+    std::string name_;
+    StageOptions options_;
+    MessageThreadPool pool_;
+    std::vector<Handler> handlers_;
+    std::chrono::steady_clock::time_point start_;
+
+    std::condition_variable cv_;
+    size_t occupancy_ = 0;
+    size_t max_occupancy_ = 0;
+    uint64_t processed_ = 0;
+    uint64_t blocked_ns_ = 0;
+    uint64_t next_sequence_ = 0;
+    std::atomic<uint64_t> busy_ns_{0};
+};
+
+template <typename In>
+class Input : public StageBase {
+  public:
+    using StageBase::StageBase;
+
+    // Blocks while the stage is full.
+    virtual void Push(In item) = 0;
+};
+
+template <typename In, typename Out>
+class TransformStage final : public Input<In> {
+  public:
+    TransformStage(std::string name, const StageOptions& options, std::function<Out(In)> f)
+        : Input<In>(std::move(name), options), f_(std::move(f)) {}
+
+    void SetNext(Input<Out>* next) { next_ = next; }
+
+    void Push(In item) override {
+        auto sequence = this->Admit();
+        this->Dispatch(sequence, [this, sequence, item = std::move(item)]() mutable {
+            Out out = this->Timed([&] { return f_(std::move(item)); });
+            Emit(sequence, std::move(out));
+        });
+    }
+
+  private:
+    // Hands results on; in an ordered parallel stage they wait in a reorder buffer until every
+    // earlier item has gone. The worker that completes the next expected item hands on the run.
+    void Emit(uint64_t sequence, Out out) {
+        if (!this->Ordered()) {
+            next_->Push(std::move(out));
+            this->Release();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        reorder_.emplace(sequence, std::move(out));
+        if (emitting_) {
+            return;
+        }
+        emitting_ = true;
+        while (true) {
+            auto it = reorder_.find(next_emit_);
+            if (it == reorder_.end()) {
+                emitting_ = false;
+                return;
+            }
+            auto ready = std::move(it->second);
+            reorder_.erase(it);
+            ++next_emit_;
+            lock.unlock();
+            next_->Push(std::move(ready));
+            this->Release();
+            lock.lock();
+        }
+    }
+
+  private:
+    std::function<Out(In)> f_;
+    Input<Out>* next_ = nullptr;
+    std::map<uint64_t, Out> reorder_;
+    uint64_t next_emit_ = 0;
+    bool emitting_ = false;
+};
+
+template <typename In>
+class SinkStage final : public Input<In> {
+  public:
+    SinkStage(std::string name, const StageOptions& options, std::function<void(In)> f)
+        : Input<In>(std::move(name), options), f_(std::move(f)) {}
+
+    void Push(In item) override {
+        auto sequence = this->Admit();
+        this->Dispatch(sequence, [this, item = std::move(item)]() mutable {
+            this->Timed([&] { f_(std::move(item)); });
+            this->Release();
+        });
+    }
+
+  private:
+    std::function<void(In)> f_;
+};
+
+}  // namespace pipeline_internal
+
+/**
+ * A chain of stages, each running on its own looper or pool of loopers and connected by bounded
+ * queues. Built with PipelineBuilder; items enter through Push().
+ */
+template <typename In>
+class Pipeline final {
+  public:
+    Pipeline(std::vector<std::unique_ptr<pipeline_internal::StageBase>> stages,
+             pipeline_internal::Input<In>* head)
+        : stages_(std::move(stages)), head_(head) {}
+
+    ~Pipeline() {
+        Close();
+        for (auto& stage : stages_) {
+            stage->Stop();
+        }
+    }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+  public:
+    // Blocks while the first stage is full, which is where backpressure surfaces to producers.
+    // Must not be called from one of the pipeline's own loopers.
+    void Push(In item) { head_->Push(std::move(item)); }
+
+    // Waits until every pushed item has left the last stage. Stages are drained in order: once a
+    // stage is idle, everything it produced has been admitted downstream.
+    void Close() {
+        for (auto& stage : stages_) {
+            stage->WaitIdle();
+        }
+    }
+
+    [[nodiscard]] std::vector<StageStats> GetStats() const {
+        std::vector<StageStats> stats;
+        for (const auto& stage : stages_) {
+            stats.push_back(stage->GetStats());
+        }
+        return stats;
+    }
+
+    // The stage whose workers are busiest, i.e. the one to scale out first.
+    [[nodiscard]] std::string Bottleneck() const {
+        auto stats = GetStats();
+        auto busiest = std::max_element(stats.begin(), stats.end(),
+                                        [](const StageStats& a, const StageStats& b) {
+                                            return a.utilization < b.utilization;
+                                        });
+        return busiest == stats.end() ? std::string() : busiest->name;
+    }
+
+  private:
+    std::vector<std::unique_ptr<pipeline_internal::StageBase>> stages_;
+    pipeline_internal::Input<In>* head_;
+};
+
+/**
+ * Builds a Pipeline stage by stage. `In` is the type pushed into the pipeline and `Current` the
+ * output type of the last stage added so far:
+ *
+ *   StageOptions parallel;
+ *   parallel.workers = 4;
+ *   auto pipeline = PipelineBuilder<std::string>()
+ *                           .Stage("parse", Parse)
+ *                           .Stage("enrich", Enrich, parallel)
+ *                           .Sink("write", Write);
+ */
+template <typename In, typename Current = In>
+class PipelineBuilder final {
+  public:
+    PipelineBuilder() = default;
+    ~PipelineBuilder() = default;
+
+    PipelineBuilder(PipelineBuilder&&) noexcept = default;
+    PipelineBuilder& operator=(PipelineBuilder&&) noexcept = default;
+
+    template <typename F, typename Out = std::invoke_result_t<F, Current>>
+    PipelineBuilder<In, Out> Stage(std::string name, F f, const StageOptions& options = {}) && {
+        auto stage = std::make_unique<pipeline_internal::TransformStage<Current, Out>>(
+                std::move(name), options, std::function<Out(Current)>(std::move(f)));
+        auto* raw = stage.get();
+        Connect(raw);
+        PipelineBuilder<In, Out> next;
+        next.stages_ = std::move(stages_);
+        next.stages_.push_back(std::move(stage));
+        next.head_ = Head(raw);
+        next.connect_ = [raw](pipeline_internal::Input<Out>* downstream) {
+            raw->SetNext(downstream);
+        };
+        return next;
+    }
+
+    // Adds the final stage and starts the pipeline. Sink workers run concurrently, so a sink with
+    // several workers does not preserve order.
+    template <typename F>
+    std::unique_ptr<Pipeline<In>> Sink(std::string name, F f, const StageOptions& options = {}) && {
+        auto stage = std::make_unique<pipeline_internal::SinkStage<Current>>(
+                std::move(name), options, std::function<void(Current)>(std::move(f)));
+        auto* raw = stage.get();
+        Connect(raw);
+        stages_.push_back(std::move(stage));
+        return std::make_unique<Pipeline<In>>(std::move(stages_), Head(raw));
+    }
+
+  private:
+    template <typename, typename>
+    friend class PipelineBuilder;
+
+    // The first stage added becomes the pipeline's entry point.
+    pipeline_internal::Input<In>* Head(pipeline_internal::Input<Current>* stage) const {
+        if constexpr (std::is_same_v<In, Current>) {
+            return head_ ? head_ : stage;
+        } else {
+            return head_;
+        }
+    }
+
+    void Connect(pipeline_internal::Input<Current>* stage) {
+        if (connect_) {
+            connect_(stage);
+        }
+    }
+
+  private:
+    std::vector<std::unique_ptr<pipeline_internal::StageBase>> stages_;
+    pipeline_internal::Input<In>* head_ = nullptr;
+    std::function<void(pipeline_internal::Input<Current>*)> connect_;
+};
+
+}  // namespace mt
@@ -0,0 +1,97 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+
+namespace mt {
+
+/**
+ * An epoll set plus an eventfd that interrupts a blocked Wait(). A MessageQueue switches to it once
+ * file descriptors are watched, so that its own messages and those descriptors are waited on in a
+ * single blocking call.
+ */
+class Poller final {
+  public:
+    Poller()
+        : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+          wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+        if (IsValid()) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = wake_fd_;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+        }
+    }
+
+    ~Poller() {
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        if (wake_fd_ >= 0) close(wake_fd_);
+    }
+
+    Poller(const Poller&) = delete;
+    Poller& operator=(const Poller&) = delete;
+
+  public:
+    [[nodiscard]] bool IsValid() const { return epoll_fd_ >= 0 && wake_fd_ >= 0; }
+
+    bool Add(int fd, uint32_t events) { return Control(EPOLL_CTL_ADD, fd, events); }
+
+    bool Modify(int fd, uint32_t events) { return Control(EPOLL_CTL_MOD, fd, events); }
+
+    bool Remove(int fd) { return epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == 0; }
+
+    void Wake() {
+        uint64_t one = 1;
+        [[maybe_unused]] auto written = write(wake_fd_, &one, sizeof(one));
+    }
+
+    // Blocks for up to `timeout_ms` (-1 waits forever). Returns the number of events stored in
+    // `events`; wakeups through Wake() are consumed here and not reported.
+    int Wait(int timeout_ms, epoll_event* events, int max_events) {
+        int count = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+        if (count < 0) {
+            return 0;  // EINTR: treated as a spurious wakeup.
+        }
+        int kept = 0;
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.fd == wake_fd_) {
+                uint64_t value;
+                [[maybe_unused]] auto consumed = read(wake_fd_, &value, sizeof(value));
+                continue;
+            }
+            events[kept++] = events[i];
+        }
+        return kept;
+    }
+
+  private:
+    bool Control(int operation, int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl(epoll_fd_, operation, fd, &event) == 0;
+    }
+
+  private:
+    int epoll_fd_;
+    int wake_fd_;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__)
@@ -0,0 +1,402 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+
+#include "thread.h"
+
+namespace mt {
+
+/**
+ * A message received from another process. `bytes` points into the shared ring and stays valid
+ * until the receive callback returns; copy it out to keep it longer.
+ */
+struct RemoteMessage {
+    int32_t what = 0;
+    int64_t arg1 = 0;
+    int64_t arg2 = 0;
+    const void* bytes = nullptr;
+    size_t length = 0;
+};
+
+/**
+ * A bounded lock-free ring of plain-data messages in a memory-mapped file, shared between
+ * processes on one host. Slots carry a sequence number (Vyukov's bounded MPMC queue), so any
+ * number of processes may post while the owning process receives.
+ *
+ * Wakeups go through a FIFO next to the ring file. The receiver arms a flag in the shared header
+ * before it sleeps; a sender writes one byte to the FIFO only when it finds the flag armed, so a
+ * busy receiver costs its senders no system calls. A FIFO rather than a futex or eventfd, because
+ * the receiving Looper must be able to epoll it and unrelated processes cannot share an eventfd
+ * without passing descriptors.
+ *
+ * A sender that dies between claiming a slot and publishing it stalls the ring at that slot.
+ */
+class ShmChannel final {
+  public:
+    static constexpr uint64_t kMagic = 0x6d742d73686d7631;  // "mt-shmv1"
+
+    // Creates (or replaces) the ring at `path` with `capacity` slots, rounded up to a power of
+    // two, each holding up to `max_payload` bytes.
+    static std::unique_ptr<ShmChannel> Create(const std::string& path, uint32_t capacity,
+                                              uint32_t max_payload) {
+        capacity = RoundUpToPowerOfTwo(std::max<uint32_t>(capacity, 2));
+        auto slot_size = static_cast<uint32_t>(
+                (sizeof(SlotHeader) + max_payload + kCacheLine - 1) / kCacheLine * kCacheLine);
+        auto size = sizeof(Header) + static_cast<size_t>(capacity) * slot_size;
+
+        unlink(path.c_str());
+        unlink(DoorbellPath(path).c_str());
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return nullptr;
+        }
+        void* base = ftruncate(fd, static_cast<off_t>(size)) == 0
+                             ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                             : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            unlink(path.c_str());
+            return nullptr;
+        }
+        auto channel = std::unique_ptr<ShmChannel>(new ShmChannel(path, base, size, true));
+        auto* header = new (base) Header();
+        header->capacity = capacity;
+        header->slot_size = slot_size;
+        header->max_payload = max_payload;
+        for (uint32_t i = 0; i < capacity; ++i) {
+            new (channel->SlotAt(i)) SlotHeader();
+            channel->SlotAt(i)->sequence.store(i, std::memory_order_relaxed);
+        }
+        // The doorbell is opened read-write so that it never reports EOF while no sender is open.
+        if (mkfifo(DoorbellPath(path).c_str(), 0600) != 0 ||
+            (channel->doorbell_ = open(DoorbellPath(path).c_str(),
+                                       O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+            return nullptr;
+        }
+        header->magic.store(kMagic, std::memory_order_release);
+        return channel;
+    }
+
+    // Maps an existing ring for sending. Returns nullptr if it does not exist or is not ready.
+    static std::unique_ptr<ShmChannel> Open(const std::string& path) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st {};
+        void* base = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)
+                             ? mmap(nullptr, static_cast<size_t>(st.st_size),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                             : MAP_FAILED;
+        close(fd);
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+        auto size = static_cast<size_t>(st.st_size);
+        auto channel = std::unique_ptr<ShmChannel>(new ShmChannel(path, base, size, false));
+        auto* header = channel->header_;
+        if (header->magic.load(std::memory_order_acquire) != kMagic ||
+            sizeof(Header) + static_cast<size_t>(header->capacity) * header->slot_size > size) {
+            return nullptr;
+        }
+        channel->doorbell_ = open(DoorbellPath(path).c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (channel->doorbell_ < 0) {
+            return nullptr;
+        }
+        return channel;
+    }
+
+    ~ShmChannel() {
+        if (doorbell_ >= 0) close(doorbell_);
+        munmap(base_, size_);
+        if (owner_) {
+            unlink(path_.c_str());
+            unlink(DoorbellPath(path_).c_str());
+        }
+    }
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+  public:
+    // Copies the message into a free slot. Returns false if the ring is full or `length` exceeds
+    // the channel's payload size; the caller decides whether to retry, drop or fall back.
+    bool TryPost(int32_t what, int64_t arg1, int64_t arg2, const void* bytes, size_t length) {
+        if (length > header_->max_payload) {
+            return false;
+        }
+        auto mask = header_->capacity - 1;
+        auto position = header_->enqueue.load(std::memory_order_relaxed);
+        SlotHeader* slot;
+        while (true) {
+            slot = SlotAt(position & mask);
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<int64_t>(sequence - position);
+            if (diff == 0) {
+                if (header_->enqueue.compare_exchange_weak(position, position + 1,
+                                                           std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = header_->enqueue.load(std::memory_order_relaxed);
+            }
+        }
+        slot->what = what;
+        slot->length = static_cast<uint32_t>(length);
+        slot->arg1 = arg1;
+        slot->arg2 = arg2;
+        if (length > 0) {
+            std::memcpy(Payload(slot), bytes, length);
+        }
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        // Pairs with the fence in Arm(): either the receiver sees this message when it re-checks,
+        // or this sender sees the armed flag and rings.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->armed.load(std::memory_order_relaxed) != 0 &&
+            header_->armed.exchange(0, std::memory_order_relaxed) != 0) {
+            Ring();
+        }
+        return true;
+    }
+
+    // Receiver side: hands each published message to `callback` in place and frees its slot
+    // afterwards. Stops after `max_messages`; returns how many were received.
+    template <typename F>
+    size_t Receive(F&& callback, size_t max_messages) {
+        auto mask = header_->capacity - 1;
+        size_t received = 0;
+        while (received < max_messages) {
+            auto position = header_->dequeue.load(std::memory_order_relaxed);
+            auto* slot = SlotAt(position & mask);
+            if (slot->sequence.load(std::memory_order_acquire) != position + 1) {
+                break;
+            }
+            RemoteMessage message;
+            message.what = slot->what;
+            message.arg1 = slot->arg1;
+            message.arg2 = slot->arg2;
+            message.bytes = Payload(slot);
+            message.length = slot->length;
+            callback(static_cast<const RemoteMessage&>(message));
+            header_->dequeue.store(position + 1, std::memory_order_relaxed);
+            slot->sequence.store(position + mask + 1, std::memory_order_release);
+            ++received;
+        }
+        return received;
+    }
+
+    // Receiver side: asks senders to ring the doorbell for the next message. Returns false if a
+    // message arrived meanwhile, in which case the receiver must not sleep.
+    bool Arm() {
+        header_->armed.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto position = header_->dequeue.load(std::memory_order_relaxed);
+        auto* slot = SlotAt(position & (header_->capacity - 1));
+        if (slot->sequence.load(std::memory_order_acquire) == position + 1) {
+            header_->armed.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Receiver side: consumes pending doorbell rings.
+    void Acknowledge() {
+        char buffer[64];
+        while (read(doorbell_, buffer, sizeof(buffer)) > 0) {
+        }
+    }
+
+    // Wakes the receiver whether or not it is armed.
+    void Ring() {
+        char one = 1;
+        // EAGAIN means the FIFO is full of unread rings, which wakes the receiver just as well.
+        [[maybe_unused]] auto written = write(doorbell_, &one, 1);
+    }
+
+    [[nodiscard]] int DoorbellFd() const { return doorbell_; }
+    [[nodiscard]] uint32_t Capacity() const { return header_->capacity; }
+    [[nodiscard]] uint32_t MaxPayload() const { return header_->max_payload; }
+
+  private:
+    static constexpr size_t kCacheLine = 64;
+
+    struct Header {
+        std::atomic<uint64_t> magic{0};
+        uint32_t capacity = 0;
+        uint32_t slot_size = 0;
+        uint32_t max_payload = 0;
+        alignas(kCacheLine) std::atomic<uint64_t> enqueue{0};
+        alignas(kCacheLine) std::atomic<uint64_t> dequeue{0};
+        alignas(kCacheLine) std::atomic<uint32_t> armed{0};
+    };
+
+    struct SlotHeader {
+        std::atomic<uint64_t> sequence{0};
+        int32_t what = 0;
+        uint32_t length = 0;
+        int64_t arg1 = 0;
+        int64_t arg2 = 0;
+    };
+
+    // The ring is only usable across processes if its atomics do not fall back to a lock.
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+    ShmChannel(std::string path, void* base, size_t size, bool owner)
+        : path_(std::move(path)), base_(base), size_(size), owner_(owner),
+          header_(static_cast<Header*>(base)) {}
+
+    static std::string DoorbellPath(const std::string& path) { return path + ".doorbell"; }
+
+    static uint32_t RoundUpToPowerOfTwo(uint32_t value) {
+        uint32_t power = 1;
+        while (power < value) power <<= 1;
+        return power;
+    }
+
+    SlotHeader* SlotAt(uint64_t index) const {
+        return reinterpret_cast<SlotHeader*>(static_cast<char*>(base_) + sizeof(Header) +
+                                             index * header_->slot_size);
+    }
+
+    static unsigned char* Payload(SlotHeader* slot) {
+        return reinterpret_cast<unsigned char*>(slot) + sizeof(SlotHeader);
+    }
+
+  private:
+    std::string path_;
+    void* base_;
+    size_t size_;
+    bool owner_;
+    Header* header_;
+    int doorbell_ = -1;
+};
+
+/**
+ * The receiving end of a ShmChannel, bound to a Looper. The doorbell is one of the looper's
+ * watched descriptors and messages are handed to the callback on the looper thread, in place.
+ */
+class RemoteReceiver final : public std::enable_shared_from_this<RemoteReceiver> {
+  public:
+    using Callback = std::function<void(const RemoteMessage& message)>;
+
+    // Messages handled per wakeup before other looper work gets a turn.
+    static constexpr size_t kBatch = 256;
+
+    static std::shared_ptr<RemoteReceiver> Create(const std::shared_ptr<Looper>& looper,
+                                                  const std::string& path, uint32_t capacity,
+                                                  uint32_t max_payload, Callback callback) {
+        auto channel = ShmChannel::Create(path, capacity, max_payload);
+        if (!channel) {
+            return nullptr;
+        }
+        auto receiver = std::shared_ptr<RemoteReceiver>(
+                new RemoteReceiver(looper, std::move(channel), std::move(callback)));
+        auto fd = receiver->channel_->DoorbellFd();
+        auto added = looper->AddFd(fd, EPOLLIN, [weak = receiver->weak_from_this()](uint32_t) {
+            if (auto self = weak.lock()) {
+                self->Drain();
+            }
+        });
+        if (!added) {
+            return nullptr;
+        }
+        // Senders that wrote before the doorbell was armed did not ring; drain what they left.
+        if (!receiver->channel_->Arm()) {
+            receiver->channel_->Ring();
+        }
+        return receiver;
+    }
+
+    ~RemoteReceiver() { looper_->RemoveFd(channel_->DoorbellFd()); }
+
+    RemoteReceiver(const RemoteReceiver&) = delete;
+    RemoteReceiver& operator=(const RemoteReceiver&) = delete;
+
+  private:
+    RemoteReceiver(std::shared_ptr<Looper> looper, std::unique_ptr<ShmChannel> channel,
+                   Callback callback)
+        : looper_(std::move(looper)),
+          channel_(std::move(channel)),
+          callback_(std::move(callback)) {}
+
+    void Drain() {
+        channel_->Acknowledge();
+        // Still busy, or a message raced with arming: ring ourselves so that the rest is handled
+        // on the next wakeup, behind whatever else the looper has queued.
+        if (channel_->Receive(callback_, kBatch) == kBatch || !channel_->Arm()) {
+            channel_->Ring();
+        }
+    }
+
+  private:
+    std::shared_ptr<Looper> looper_;
+    std::unique_ptr<ShmChannel> channel_;
+    Callback callback_;
+};
+
+/**
+ * Posts plain-data messages into another process's Looper through its ShmChannel. Safe to use
+ * from any number of threads and processes at once.
+ */
+class RemoteHandler final {
+  public:
+    // Returns nullptr if no receiver has created `path` yet.
+    static std::unique_ptr<RemoteHandler> Open(const std::string& path) {
+        auto channel = ShmChannel::Open(path);
+        if (!channel) {
+            return nullptr;
+        }
+        return std::unique_ptr<RemoteHandler>(new RemoteHandler(std::move(channel)));
+    }
+
+    ~RemoteHandler() = default;
+
+    RemoteHandler(const RemoteHandler&) = delete;
+    RemoteHandler& operator=(const RemoteHandler&) = delete;
+
+  public:
+    // Returns false if the receiver's ring is full or the payload does not fit in a slot.
+    bool Post(int32_t what, int64_t arg1 = 0, int64_t arg2 = 0, const void* bytes = nullptr,
+              size_t length = 0) {
+        return channel_->TryPost(what, arg1, arg2, bytes, length);
+    }
+
+    [[nodiscard]] uint32_t MaxPayload() const { return channel_->MaxPayload(); }
+
+  private:
+    explicit RemoteHandler(std::unique_ptr<ShmChannel> channel) : channel_(std::move(channel)) {}
+
+  private:
+    std::unique_ptr<ShmChannel> channel_;
+};
+
+}  // namespace mt
+
+#endif  // defined(__linux__)
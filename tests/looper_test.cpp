@@ -0,0 +1,130 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#include "thread.h"
+
+/**
+ * Regression tests for the looper, run by ctest as `looper_test`. Each test returns normally on
+ * success; a failed CHECK prints its location and makes the process exit with status 1.
+ */
+
+namespace mt::test {
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                             \
+    do {                                                                             \
+        if (!(condition)) {                                                          \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                         #condition);                                                \
+            ++failures;                                                              \
+        }                                                                            \
+    } while (false)
+
+using namespace std::chrono_literals;
+
+// A message shed for its deadline must not stop AdvanceTime() from stepping to later timers.
+void TestAdvanceTimeStepsPastShedMessage() {
+    ManualLooper looper;
+    Handler handler(looper.GetLooper());
+    auto start = looper.Now();
+    bool shed_ran = false;
+    TimePoint timer_time{};
+    handler.PostWithDeadline([&] { shed_ran = true; }, start + 5ms, 10ms);
+    handler.Post([&] { timer_time = looper.Now(); }, 20ms);
+
+    looper.AdvanceTime(100ms);
+    CHECK(!shed_ran);
+    CHECK(timer_time == start + 20ms);
+    CHECK(looper.Now() == start + 100ms);
+}
+
+// A cancelled far-future message must not keep a quitting looper waiting for its send time.
+void TestBrakingSkipsCancelledMessage() {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    bool ran = false;
+    auto message = handler.PostCancelable([&] { ran = true; }, 3000ms);
+    CHECK(message != nullptr);
+    message->Cancel();
+
+    auto start = std::chrono::steady_clock::now();
+    thread.Braking();
+    CHECK(std::chrono::steady_clock::now() - start < 500ms);
+    CHECK(!ran);
+}
+
+#if defined(__linux__)
+// A ready descriptor must be serviced even while a message is always due, after a bounded number
+// of messages rather than only once the queue runs dry.
+void TestBusyLooperServicesFds() {
+    MessageThread thread;
+    Handler handler(thread.GetLooper());
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+
+    int busy = 0;
+    bool fd_ready = false;
+    std::promise<int> done;
+    CHECK(thread.GetLooper()->AddFd(fds[0], EPOLLIN, [&](uint32_t) {
+        char byte;
+        CHECK(read(fds[0], &byte, 1) == 1);
+        fd_ready = true;
+    }));
+    std::function<void()> spin = [&] {
+        if (busy == 0) {
+            CHECK(write(fds[1], "x", 1) == 1);
+        }
+        if (fd_ready || busy == 100000) {
+            done.set_value(busy);
+            return;
+        }
+        ++busy;
+        handler.Post(spin);
+    };
+    handler.Post(spin);
+
+    CHECK(done.get_future().get() <= 2 * 64);
+    thread.GetLooper()->RemoveFd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+}  // namespace
+}  // namespace mt::test
+
+int main() {
+    using namespace mt::test;
+    std::vector<std::pair<const char*, std::function<void()>>> tests = {
+            {"AdvanceTimeStepsPastShedMessage", TestAdvanceTimeStepsPastShedMessage},
+            {"BrakingSkipsCancelledMessage", TestBrakingSkipsCancelledMessage},
+#if defined(__linux__)
+            {"BusyLooperServicesFds", TestBusyLooperServicesFds},
+#endif
+    };
+    for (const auto& [name, test] : tests) {
+        auto before = failures;
+        test();
+        std::printf("%s %s\n", failures == before ? "PASS" : "FAIL", name);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/**
+ * message-thread is open source and released under the Apache License, Version 2.0.
+ * You can find a copy of this license in the `https://www.apache.org/licenses/LICENSE-2.0`.
+ *
+ * For those wishing to use message-thread under terms other than those of the Apache License, a
+ * commercial license is available. For more information on the commercial license terms and how to
+ * obtain a commercial license, please contact me.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mt {
+
+/**
+ * How a worker thread is set up before its looper starts. Everything defaults to what a plain
+ * std::thread gets. Only Linux applies these; elsewhere a thread with non-default options reports
+ * that they could not be applied.
+ */
+struct ThreadOptions {
+    // Shown by `top -H`, ps and perf. Linux truncates it to 15 characters.
+    std::string name;
+    // CPUs the thread may run on; empty leaves the inherited affinity.
+    std::vector<int> cpus;
+    // Runs the thread under SCHED_FIFO with this priority (1-99) when non-zero. Needs
+    // CAP_SYS_NICE or an RLIMIT_RTPRIO allowance.
+    int fifo_priority = 0;
+    // Nice level for a SCHED_OTHER thread (-20..19); values below the current one need
+    // CAP_SYS_NICE. Ignored when fifo_priority is set.
+    int nice = 0;
+    bool set_nice = false;
+    // Stack size in bytes; 0 keeps the platform default.
+    size_t stack_size = 0;
+    // Locks current and future pages of the whole process into RAM (mlockall), so the looper
+    // does not take page faults on its stack or heap. This is process-wide, not per thread.
+    bool lock_memory = false;
+
+    [[nodiscard]] bool IsDefault() const {
+        return name.empty() && cpus.empty() && fifo_priority == 0 && !set_nice &&
+               stack_size == 0 && !lock_memory;
+    }
+};
+
+/**
+ * Applies everything but the stack size (which is fixed at creation) to the calling thread.
+ * Options that fail are skipped and the rest still applied; returns false if any failed.
+ */
+inline bool ApplyThreadOptions(const ThreadOptions& options) {
+#if defined(__linux__)
+    bool ok = true;
+    if (!options.name.empty()) {
+        ok &= pthread_setname_np(pthread_self(), options.name.substr(0, 15).c_str()) == 0;
+    }
+    if (!options.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : options.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        ok &= pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+    if (options.fifo_priority != 0) {
+        sched_param param{};
+        param.sched_priority = options.fifo_priority;
+        ok &= pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+    } else if (options.set_nice) {
+        // Linux keeps nice values per thread, addressed by tid.
+        auto tid = static_cast<id_t>(syscall(SYS_gettid));
+        ok &= setpriority(PRIO_PROCESS, tid, options.nice) == 0;
+    }
+    if (options.lock_memory) {
+        ok &= mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    }
+    return ok;
+#else
+    auto rest = options;
+    rest.stack_size = 0;
+    return rest.IsDefault();
+#endif
+}
+
+/**
+ * A joinable thread that can be given a stack size, which std::thread cannot. On Linux it is a
+ * pthread; elsewhere a std::thread, and the stack size is ignored.
+ */
+class NativeThread final {
+  public:
+    NativeThread() = default;
+    ~NativeThread() { Join(); }
+
+    NativeThread(const NativeThread&) = delete;
+    NativeThread& operator=(const NativeThread&) = delete;
+
+  public:
+    // Returns false if the thread could not be created (e.g. an invalid stack size).
+    bool Start(size_t stack_size, std::function<void()> body) {
+#if defined(__linux__)
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (stack_size != 0 && pthread_attr_setstacksize(&attr, stack_size) != 0) {
+            pthread_attr_destroy(&attr);
+            return false;
+        }
+        auto* start = new std::function<void()>(std::move(body));
+        auto result = pthread_create(&thread_, &attr, &NativeThread::Entry, start);
+        pthread_attr_destroy(&attr);
+        if (result != 0) {
+            delete start;
+            return false;
+        }
+        joinable_ = true;
+#else
+        (void)stack_size;
+        thread_ = std::thread(std::move(body));
+#endif
+        return true;
+    }
+
+    [[nodiscard]] bool Joinable() const {
+#if defined(__linux__)
+        return joinable_;
+#else
+        return thread_.joinable();
+#endif
+    }
+
+    void Join() {
+#if defined(__linux__)
+        if (joinable_) {
+            pthread_join(thread_, nullptr);
+            joinable_ = false;
+        }
+#else
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+#endif
+    }
+
+  private:
+#if defined(__linux__)
+    static void* Entry(void* arg) {
+        std::unique_ptr<std::function<void()>> body(static_cast<std::function<void()>*>(arg));
+        (*body)();
+        return nullptr;
+    }
+
+    pthread_t thread_{};
+    bool joinable_ = false;
+#else
+    std::thread thread_;
+#endif
+};
+
+}  // namespace mt